@@ -8,6 +8,9 @@
 #include <boost/asio/io_service.hpp>
 #include <boost/bind.hpp>
 #include <boost/core/checked_delete.hpp>
+#include <boost/detail/atomic_count.hpp>
+#include <memory>
+#include <vector>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -246,29 +249,67 @@ namespace ho
 	{
 		typedef boost::asio::io_service io_service;
 
-		static io_service& get_io_service()
+		// load of one shard
+		struct shard_stats
 		{
-			return instance()->_io_service;
+			long queued;	// posted through net_service but not yet run, pending i/o is not counted
+			long handled;	// handlers run since the service was created, i/o completions and timers included
+		};
+
+		// takes effect when the service is (re)created, i.e. before first use or after shutdown()
+		static void set_shard_count(size_t n)
+		{
+			configured_shards() = n ? n : 1;
+		}
+
+		static size_t shard_count()
+		{
+			return instance()->_shards.size();
+		}
+
+		// round-robin shard for a new long-lived object (device affinity)
+		static size_t next_shard()
+		{
+			net_service *s = instance().get();
+			return (size_t)(++s->_next_shard) % s->_shards.size();
+		}
+
+		static io_service& get_io_service(size_t shard = 0)
+		{
+			return get_shard(shard)._io_service;
 		}
 
 		template <typename F>
-		static void async_call(const F& f)
+		static void async_call(const F& f, size_t shard = 0)
 		{
-			get_io_service().post(f);
+			shard_type& s = get_shard(shard);
+			++s._queued;
+			s._io_service.post(counted_handler<F>(f, &s));
 		}
 
 		template <typename F>
-		static void sync_call(const F& f)
+		static void sync_call(const F& f, size_t shard = 0)
 		{
 			ho::event e;
-			get_io_service().dispatch(sync_handler<F>(f, &e));
+			shard_type& s = get_shard(shard);
+			++s._queued;
+			s._io_service.dispatch(counted_handler<sync_handler<F> >(sync_handler<F>(f, &e), &s));
 			e.wait();
 		}
 
 		template <typename T>
-		static void async_delete(T *x)
+		static void async_delete(T *x, size_t shard = 0)
 		{
-			get_io_service().post(boost::bind(&boost::checked_delete<T>, x));
+			async_call(boost::bind(&boost::checked_delete<T>, x), shard);
+		}
+
+		static shard_stats get_stats(size_t shard)
+		{
+			shard_type& s = get_shard(shard);
+			shard_stats r;
+			r.queued = s._queued;
+			r.handled = s._handled;
+			return r;
 		}
 
 		static void shutdown()
@@ -278,11 +319,50 @@ namespace ho
 
 		~net_service()
 		{
-			delete _work;
-			_thread.join();
+			for (size_t i=0; i<_shards.size(); ++i)
+			{
+				delete _shards[i]->_work;
+				_shards[i]->_thread.join();
+				delete _shards[i];
+			}
 		}
 
 	private:
+		struct shard_type : boost::noncopyable
+		{
+			shard_type() : _queued(0), _handled(0)
+			{
+				_work = new io_service::work(_io_service);
+				_thread = boost::bind(&shard_type::run, this);
+			}
+
+			// run() a handler at a time so every completion is counted, not only what was posted
+			void run()
+			{
+				while (_io_service.run_one())
+					++_handled;
+			}
+
+			io_service _io_service;
+			io_service::work *_work;
+			ho::thread _thread;
+			boost::detail::atomic_count _queued;
+			boost::detail::atomic_count _handled;
+		};
+
+		template <typename F>
+		struct counted_handler
+		{
+			counted_handler(const F& f, shard_type *s) : _f(f), _s(s) {}
+			void operator()()
+			{
+				--_s->_queued;
+				_f();
+			}
+			F _f;
+			shard_type *_s;
+		};
+
 		template <typename F>
 		struct sync_handler
 		{
@@ -299,6 +379,12 @@ namespace ho
 	private:
 		typedef std::auto_ptr<net_service> ptr;
 
+		static size_t& configured_shards()
+		{
+			static size_t n = 1;
+			return n;
+		}
+
 		static ptr& instance()
 		{
 			static ptr p;
@@ -307,15 +393,21 @@ namespace ho
 			return p;
 		}
 
-		net_service()
+		static shard_type& get_shard(size_t shard)
 		{
-			_work = new io_service::work(_io_service);
-			_thread = boost::bind(&io_service::run, &_io_service);
-		}	
+			net_service *s = instance().get();
+			BOOST_ASSERT(shard < s->_shards.size());
+			return *s->_shards[shard % s->_shards.size()];
+		}
+
+		net_service() : _next_shard(-1)
+		{
+			for (size_t i=0; i<configured_shards(); ++i)
+				_shards.push_back(new shard_type);
+		}
 
-		io_service _io_service;
-		io_service::work *_work;
-		ho::thread _thread;
+		std::vector<shard_type *> _shards;
+		boost::detail::atomic_count _next_shard;
 	};
 }
 
@@ -0,0 +1,165 @@
+#include "pos_capture.h"
+#include "pos_metrics.h"
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/ip/udp.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/shared_ptr.hpp>
+#include <map>
+#include <vector>
+#include <string.h>
+#include <unistd.h>
+
+namespace pos_net
+{
+	static const char c_capture_magic[8] = { 'P', 'O', 'S', 'C', 'A', 'P', '0', '1' };
+
+	static void put_le(unsigned char *p, unsigned long long v, size_t n)
+	{
+		for (size_t i=0; i<n; ++i)
+			p[i] = (unsigned char)(v >> (i * 8));
+	}
+
+	static unsigned long long get_le(const unsigned char *p, size_t n)
+	{
+		unsigned long long v = 0;
+		for (size_t i=n; i>0; --i)
+			v = v << 8 | p[i - 1];
+		return v;
+	}
+
+	capture_writer::capture_writer() : _file(NULL), _started_us(0), _streams(0)
+	{
+	}
+
+	capture_writer::~capture_writer()
+	{
+		close();
+	}
+
+	bool capture_writer::open(const std::string& path)
+	{
+		close();
+		_file = fopen(path.c_str(), "wb");
+		if (!_file)
+		{
+			printf("[pos_net] capture open error(%s)\n", path.c_str());
+			return false;
+		}
+		setvbuf(_file, NULL, _IOFBF, 64 * 1024);
+		fwrite(c_capture_magic, 1, sizeof(c_capture_magic), _file);
+		_started_us = monotonic_us();
+		_streams = 0;
+		return true;
+	}
+
+	void capture_writer::close()
+	{
+		ho::lock_guard lock(_mutex);
+		if (_file)
+		{
+			fclose(_file);
+			_file = NULL;
+		}
+	}
+
+	unsigned int capture_writer::new_stream()
+	{
+		ho::lock_guard lock(_mutex);
+		return ++_streams;
+	}
+
+	void capture_writer::write(unsigned int stream, const char *p, size_t n)
+	{
+		unsigned char head[16];
+		put_le(head, monotonic_us() - _started_us, 8);
+		put_le(head + 8, stream, 4);
+		put_le(head + 12, n, 4);
+		ho::lock_guard lock(_mutex);
+		if (!_file)
+			return;
+		fwrite(head, 1, sizeof(head), _file);
+		fwrite(p, 1, n, _file);
+	}
+
+	bool replay(const replay_parm& p, replay_stats& stats)
+	{
+		using namespace boost::asio::ip;
+		memset(&stats, 0, sizeof(stats));
+		if (p.proto != PROTO_TCP && p.proto != PROTO_UDP)
+		{
+			printf("[pos_net] replay over tcp or udp only\n");
+			return false;
+		}
+		FILE *f = fopen(p.file.c_str(), "rb");
+		if (!f)
+		{
+			printf("[pos_net] replay open error(%s)\n", p.file.c_str());
+			return false;
+		}
+		char magic[sizeof(c_capture_magic)];
+		if (fread(magic, 1, sizeof(magic), f) != sizeof(magic) || memcmp(magic, c_capture_magic, sizeof(magic)))
+		{
+			printf("[pos_net] not a capture(%s)\n", p.file.c_str());
+			fclose(f);
+			return false;
+		}
+
+		bool ok = true;
+		boost::asio::io_service io;
+		std::map<unsigned int, boost::shared_ptr<tcp::socket> > tcp_streams;
+		std::map<unsigned int, boost::shared_ptr<udp::socket> > udp_streams;
+		std::vector<char> data;
+		unsigned long long started_us = monotonic_us();
+		try
+		{
+			address a = address::from_string(p.host);
+			unsigned char head[16];
+			while (fread(head, 1, sizeof(head), f) == sizeof(head))
+			{
+				unsigned long long at_us = get_le(head, 8);
+				unsigned int stream = (unsigned int)get_le(head + 8, 4);
+				data.resize(get_le(head + 12, 4));
+				if (!data.empty() && fread(&data[0], 1, data.size(), f) != data.size())
+					break;
+
+				if (p.speed > 0)
+				{
+					unsigned long long due = started_us + (unsigned long long)(at_us / p.speed);
+					unsigned long long now = monotonic_us();
+					if (due > now)
+						usleep((useconds_t)(due - now));
+				}
+
+				if (p.proto == PROTO_TCP)
+				{
+					boost::shared_ptr<tcp::socket>& s = tcp_streams[stream];
+					if (!s)
+					{
+						s.reset(new tcp::socket(io));
+						s->connect(tcp::endpoint(a, p.port));
+						s->set_option(tcp::no_delay(true));
+					}
+					boost::asio::write(*s, boost::asio::buffer(data));
+				}
+				else
+				{
+					boost::shared_ptr<udp::socket>& s = udp_streams[stream];
+					if (!s)
+						s.reset(new udp::socket(io, udp::endpoint(a.is_v4() ? udp::v4() : udp::v6(), 0)));
+					s->send_to(boost::asio::buffer(data), udp::endpoint(a, p.port));
+				}
+				++stats.records;
+				stats.bytes += data.size();
+			}
+		}
+		catch (const std::exception& e)
+		{
+			printf("[pos_net] replay error(%s)\n", e.what());
+			ok = false;
+		}
+		fclose(f);
+		stats.streams = tcp_streams.size() + udp_streams.size();
+		stats.elapsed_us = monotonic_us() - started_us;
+		return ok;
+	}
+}
@@ -0,0 +1,56 @@
+#ifndef __pos_capture_h__
+#define __pos_capture_h__
+
+#include <stdio.h>
+#include <string>
+#include "net_driver.h"
+#include "pos_net.h"
+
+namespace pos_net
+{
+	// capture file : "POSCAP01" then one record per read, all integers little endian
+	//   u64 us since the capture opened, u32 stream (one per tcp session / udp source / tty), u32 size, size raw bytes
+
+	// appends the raw bytes of every stream of a pos_net::start handle, shared by its io shards
+	struct capture_writer : boost::noncopyable
+	{
+		capture_writer();
+		~capture_writer();
+
+		bool open(const std::string& path);
+		void close();
+
+		unsigned int new_stream();
+		void write(unsigned int stream, const char *p, size_t n);
+
+	private:
+		ho::mutex _mutex;
+		FILE *_file;
+		unsigned long long _started_us;
+		unsigned int _streams;
+	};
+
+	struct replay_parm
+	{
+		replay_parm() : proto(PROTO_TCP), host("127.0.0.1"), port(0), speed(1) {}
+
+		std::string file;
+		e_proto proto;		// PROTO_TCP : a connection per captured stream, PROTO_UDP : a datagram per record
+		std::string host;
+		unsigned short port;
+		double speed;		// 1 = captured pace, N = N times faster, 0 = back to back
+	};
+
+	struct replay_stats
+	{
+		unsigned long records;
+		unsigned long streams;
+		unsigned long long bytes;
+		unsigned long long elapsed_us;
+	};
+
+	// sends a capture to a running pos_net::start, blocks until the last record is sent
+	bool replay(const replay_parm& p, replay_stats& stats);
+}
+
+#endif // __pos_capture_h__
@@ -32,8 +32,11 @@ namespace pos_db
 	struct sqlite_con
 	{
 		sqlite3 *_db;
+		sqlite3_stmt *_insert_record;
+		sqlite3_stmt *_insert_item;
+		sqlite3_stmt *_insert_terminal;
 
-		sqlite_con() : _db(NULL) {}
+		sqlite_con() : _db(NULL), _insert_record(NULL), _insert_item(NULL), _insert_terminal(NULL) {}
 
 		static int get_version_callback(void *user_parm, int, char **v, char**)
 		{
@@ -135,9 +138,35 @@ namespace pos_db
 				printf("[pos_db] exec %s fail.\n", cmd);
 		}
 
+		// cached for the lifetime of the connection, NULL on failure
+		sqlite3_stmt *prepare(sqlite3_stmt *&stmt, const char *sql)
+		{
+			if (!stmt && _db && sqlite3_prepare_v2(_db, sql, -1, &stmt, NULL) != SQLITE_OK)
+			{
+				printf("[pos_db] prepare %s fail : %s\n", sql, sqlite3_errmsg(_db));
+				stmt = NULL;
+			}
+			return stmt;
+		}
+
+		bool step(sqlite3_stmt *stmt)
+		{
+			int r = sqlite3_step(stmt);
+			sqlite3_reset(stmt);
+			sqlite3_clear_bindings(stmt);
+			if (r == SQLITE_DONE)
+				return true;
+			printf("[pos_db] step %s fail : %s\n", sqlite3_sql(stmt), sqlite3_errmsg(_db));
+			return false;
+		}
+
 		void close()
 		{
 			if (!_db) return;
+			sqlite3_finalize(_insert_record);
+			sqlite3_finalize(_insert_item);
+			sqlite3_finalize(_insert_terminal);
+			_insert_record = _insert_item = _insert_terminal = NULL;
 			sqlite3_close(_db);
 			_db = NULL;
 		}
@@ -178,46 +207,110 @@ namespace pos_db
 		return to_time_t(pt);
 	}
 
-	static void on_write(const record& rec)
+	// written records keep their arena capacity for the next transaction
+	struct record_pool
+	{
+		static const size_t c_max_records = 16;
+
+		std::vector<arena_record *> _records;
+		ho::mutex _mutex;
+
+		~record_pool()
+		{
+			for (size_t i=0; i<_records.size(); ++i)
+				delete _records[i];
+		}
+
+		arena_record *alloc()
+		{
+			ho::lock_guard lock(_mutex);
+			if (_records.empty())
+				return NULL;
+			arena_record *rec = _records.back();
+			_records.pop_back();
+			return rec;
+		}
+
+		void free(arena_record *rec)
+		{
+			rec->items.clear();
+			rec->head.relate_channels.clear();
+			ho::lock_guard lock(_mutex);
+			if (_records.size() < c_max_records)
+				_records.push_back(rec);
+			else
+				delete rec;
+		}
+	};
+
+	static record_pool s_record_pool;
+
+	std::auto_ptr<arena_record> alloc_record()
+	{
+		arena_record *rec = s_record_pool.alloc();
+		return std::auto_ptr<arena_record>(rec ? rec : new arena_record);
+	}
+
+	// items are bound straight from the arena, nothing is formatted into the sql text
+	static void on_write(arena_record *rec)
 	{
+		const record& head = rec->head;
 		s_sqlite.exec("BEGIN;");
 
-		boost::format fmt(
+		sqlite3_stmt *stmt = s_sqlite.prepare(s_sqlite._insert_record,
 			"INSERT INTO t_record(pos_id, pos_name, start, stop, relate_channels)\n"
-			"VALUES(%1%, '%2%', %3%, %4%, '%5%');\n"
+			"VALUES(?, ?, ?, ?, ?);\n"
 			);
-		fmt % rec.pos_id;
-		fmt % rec.pos_name;
-		fmt % time_to_time_t(rec.start);
-		fmt % time_to_time_t(rec.stop);
 		std::string s;
-		for (size_t i=0; i<rec.relate_channels.size(); ++i)
-			s += boost::lexical_cast<std::string>((int)rec.relate_channels[i]) + ";";
-		fmt % s;
-		s_sqlite.exec(fmt.str().c_str());
+		for (size_t i=0; i<head.relate_channels.size(); ++i)
+			s += boost::lexical_cast<std::string>((int)head.relate_channels[i]) + ";";
+		if (stmt)
+		{
+			sqlite3_bind_int(stmt, 1, head.pos_id);
+			sqlite3_bind_text(stmt, 2, head.pos_name.c_str(), (int)head.pos_name.size(), SQLITE_STATIC);
+			sqlite3_bind_int64(stmt, 3, time_to_time_t(head.start));
+			sqlite3_bind_int64(stmt, 4, time_to_time_t(head.stop));
+			sqlite3_bind_text(stmt, 5, s.c_str(), (int)s.size(), SQLITE_STATIC);
+		}
 
-		unsigned long long rowid = s_sqlite.last_rowid();
-		if (rowid)
+		unsigned long long rowid = stmt && s_sqlite.step(stmt) ? s_sqlite.last_rowid() : 0;
+		stmt = s_sqlite.prepare(s_sqlite._insert_item,
+			"INSERT INTO t_item(id, i, item)\n"
+			"VALUES(?, ?, ?);\n"
+			);
+		if (rowid && stmt)
 		{
-			for (size_t i=0; i<rec.items.size(); ++i)
+			for (size_t i=0; i<rec->items.size(); ++i)
 			{
-				boost::format fmt(
-					"INSERT INTO t_item(id, i, item)\n"
-					"VALUES(%1%, %2%, '%3%');\n"
-					);
-				fmt % rowid;
-				fmt % i;
-				fmt % rec.items[i];
-				s_sqlite.exec(fmt.str().c_str());
+				sqlite3_bind_int64(stmt, 1, (sqlite3_int64)rowid);
+				sqlite3_bind_int64(stmt, 2, (sqlite3_int64)i);
+				sqlite3_bind_text(stmt, 3, rec->items.item(i), (int)rec->items.item_size(i), SQLITE_STATIC);
+				s_sqlite.step(stmt);
 			}
 		}
 		
 		s_sqlite.exec("END;");
+		s_record_pool.free(rec);
+	}
+
+	void write(std::auto_ptr<arena_record>& rec)
+	{
+		if (rec.get())
+			service::async_call(boost::bind(&on_write, rec.release()));
 	}
 
 	void write(const record& rec)
 	{
-		service::async_call(boost::bind(&on_write, rec));
+		std::auto_ptr<arena_record> r = alloc_record();
+		r->head.id = rec.id;
+		r->head.pos_id = rec.pos_id;
+		r->head.pos_name = rec.pos_name;
+		r->head.start = rec.start;
+		r->head.stop = rec.stop;
+		r->head.relate_channels = rec.relate_channels;
+		for (size_t i=0; i<rec.items.size(); ++i)
+			r->items.add(rec.items[i].c_str(), rec.items[i].size());
+		write(r);
 	}
 
 	static void time_t_to_time(const char *p, time& ret)
@@ -318,48 +411,43 @@ namespace pos_db
 		service::async_call(boost::bind(&on_query_items, p));
 	}
 
-	static void on_write_terminal_record(const std::string& rec)
+	// relate_channels stays a json array, as the query hands it back
+	static void on_write_terminal_record(const terminal_row& row)
 	{
-		s_sqlite.exec("BEGIN;");
-
-		boost::format fmt(
+		sqlite3_stmt *stmt = s_sqlite.prepare(s_sqlite._insert_terminal,
 			"INSERT INTO t_record_terminal(pos_id, pos_name, terminal_code, card_id, money, terminal_model, serial, time, dev_time, relate_channels)\n"
-			"VALUES(%1%, '%2%', '%3%', '%4%', '%5%', '%6%', '%7%', '%8%', '%9%', '%10%');\n"
+			"VALUES(?, ?, ?, ?, ?, ?, ?, ?, ?, ?);\n"
 			);
-
-		rapidjson::Document doc;
-		doc.Parse<0>(rec.c_str());
-		BOOST_ASSERT(!doc.HasParseError());
-
-		fmt % doc["pos_id"].GetInt64();
-		fmt % doc["pos_name"].GetString();
-		fmt % doc["terminal_code"].GetString();
-		fmt % doc["card_id"].GetString();
-		fmt % doc["money"].GetString();
-		fmt % doc["terminal_model"].GetString();
-		fmt % doc["serial"].GetString();
-		fmt % doc["time"].GetString();
+		if (!stmt)
+			return;
 
 		boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
 		BOOST_AUTO(d, now.date());
 		BOOST_AUTO(t, now.time_of_day());
 		char dev_time[32];
 		sprintf(dev_time, "%04d%02d%02d%02d%02d%02d", (int)d.year(), (int)d.month(), (int)d.day(), (int)t.hours(), (int)t.minutes(), (int)t.seconds());
-		fmt % dev_time;
 
-		rapidjson::StringBuffer sb;
-		rapidjson::Writer<rapidjson::StringBuffer> w(sb);
-		doc["relate_channels"].Accept(w);
-		fmt % sb.GetString();
-
-		s_sqlite.exec(fmt.str().c_str());
-
-		s_sqlite.exec("END;");
+		std::string channels = "[";
+		for (size_t i=0; i<row.relate_channels.size(); ++i)
+		{
+			if (i)
+				channels += ',';
+			channels += boost::lexical_cast<std::string>((int)row.relate_channels[i]);
+		}
+		channels += ']';
+
+		sqlite3_bind_int(stmt, 1, row.pos_id);
+		sqlite3_bind_text(stmt, 2, row.pos_name.c_str(), (int)row.pos_name.size(), SQLITE_STATIC);
+		for (size_t i=0; i<pos_net::c_terminal_field_count; ++i)
+			sqlite3_bind_text(stmt, (int)i + 3, pos_net::c_terminal_fields[i].of(row.rec), -1, SQLITE_STATIC);
+		sqlite3_bind_text(stmt, 9, dev_time, -1, SQLITE_STATIC);
+		sqlite3_bind_text(stmt, 10, channels.c_str(), (int)channels.size(), SQLITE_STATIC);
+		s_sqlite.step(stmt);
 	}
 
-	void write_terminal_record(const std::string& rec)
+	void write_terminal_record(const terminal_row& row)
 	{
-		service::async_call(boost::bind(&on_write_terminal_record, rec));
+		service::async_call(boost::bind(&on_write_terminal_record, row));
 	}
 
 	static int query_terminal_records_callback(void *user_parm, int, char **v, char**)
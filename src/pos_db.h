@@ -3,6 +3,8 @@
 
 #include <string>
 #include <vector>
+#include <memory>
+#include "pos_terminal_parser.h"
 
 namespace pos_db
 {
@@ -37,6 +39,36 @@ namespace pos_db
 
 	void write(const record& rec);
 
+	// the items of one transaction packed back to back, each NUL terminated
+	struct item_arena
+	{
+		std::vector<char> text;
+		std::vector<size_t> offsets;
+
+		void clear() { text.clear(); offsets.clear(); }
+		void add(const char *item, size_t size)
+		{
+			offsets.push_back(text.size());
+			text.insert(text.end(), item, item + size);
+			text.push_back('\0');
+		}
+		size_t size() const { return offsets.size(); }
+		const char *item(size_t i) const { return &text[offsets[i]]; }
+		size_t item_size(size_t i) const { return (i + 1 < offsets.size() ? offsets[i + 1] : text.size()) - offsets[i] - 1; }
+	};
+
+	// record filled in place by the receiver, items of head are unused
+	struct arena_record
+	{
+		record head;
+		item_arena items;
+	};
+
+	// from a pool the db thread refills, so steady state writes allocate nothing
+	std::auto_ptr<arena_record> alloc_record();
+	// ownership moves to the db thread, rec is NULL afterwards
+	void write(std::auto_ptr<arena_record>& rec);
+
 	struct query_records_parm
 	{
 		int pos_id;
@@ -60,8 +92,16 @@ namespace pos_db
 
 	void query_items(const query_items_parm& p);
 
-	//{"pos_id":1,"pos_name":"name","relate_channels":[1,7,8],"terminal_code":"1","card_id":"2","money":"99.99","terminal_model":"4","serial":"5","time":"20170417112459"}
-	void write_terminal_record(const std::string& rec);
+	// a swipe as pos_net decoded it, its fields are bound straight into a prepared insert
+	struct terminal_row
+	{
+		int pos_id;
+		std::string pos_name;
+		std::vector<unsigned char> relate_channels;
+		pos_net::terminal_record rec;
+	};
+
+	void write_terminal_record(const terminal_row& row);
 
 	struct query_terminal_records_parm
 	{
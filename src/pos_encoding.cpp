@@ -0,0 +1,321 @@
+#include "net_driver.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <list>
+#include <boost/typeof/typeof.hpp>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "pos_encoding.h"
+
+namespace pos_net
+{
+	const size_t encoding_converter::c_max_carry;
+	const size_t encoding_converter::c_max_ratio;
+
+	// double-byte encodings decoded through dbcs_table, anything else goes through libiconv
+	static const char *c_dbcs_encodings[] = { "GBK", "GB2312", "GB18030", "CP936", "EUC-CN", "BIG5", "CP950" };
+
+	static const unsigned char c_lead_min = 0x81, c_lead_max = 0xfe;
+	static const unsigned char c_trail_min = 0x40, c_trail_max = 0xfe;
+	static const size_t c_trail_num = c_trail_max - c_trail_min + 1;
+
+	// BMP code points of every single high byte and lead/trail pair, 0 = not a character;
+	// filled once per encoding by asking libiconv, so it matches the fallback exactly
+	struct dbcs_table
+	{
+		std::string encoding;
+		bool gb18030;	// lead + 0x30-0x39 starts a four byte sequence
+		unsigned short single[0x80];
+		unsigned short pair[(c_lead_max - c_lead_min + 1) * c_trail_num];
+	};
+
+	static unsigned int decode_one(libiconv_t cd, const char *in, size_t n)
+	{
+		char buf[8];
+		char *i = (char *)in, *o = buf;
+		size_t in_left = n, out_left = sizeof(buf);
+		libiconv(cd, NULL, NULL, NULL, NULL);
+		if (libiconv(cd, &i, &in_left, &o, &out_left) == (size_t)-1 || in_left)
+			return 0;
+		const unsigned char *u = (const unsigned char *)buf;
+		switch (o - buf)
+		{
+		case 2 :
+			return ((u[0] & 0x1f) << 6) | (u[1] & 0x3f);
+		case 3 :
+			return ((u[0] & 0x0f) << 12) | ((u[1] & 0x3f) << 6) | (u[2] & 0x3f);
+		default :
+			return 0;	// ASCII is not expected here, four byte UTF-8 is left to libiconv
+		}
+	}
+
+	static const dbcs_table *get_dbcs_table(const std::string& encoding)
+	{
+		static ho::mutex s_mutex;
+		static std::list<dbcs_table> s_tables;
+
+		bool known = false;
+		for (size_t i=0; i<sizeof(c_dbcs_encodings)/sizeof(c_dbcs_encodings[0]); ++i)
+			known = known || encoding == c_dbcs_encodings[i];
+		if (!known)
+			return NULL;
+
+		ho::lock_guard lock(s_mutex);
+		for (BOOST_AUTO(it, s_tables.begin()); it != s_tables.end(); ++it)
+		{
+			if (it->encoding == encoding)
+				return &*it;
+		}
+
+		libiconv_t cd = libiconv_open("UTF-8", encoding.c_str());
+		if (cd == libiconv_t(-1))
+			return NULL;
+		s_tables.push_back(dbcs_table());
+		dbcs_table *t = &s_tables.back();
+		t->encoding = encoding;
+		t->gb18030 = encoding == "GB18030";
+		for (unsigned int b=0x80; b<=0xff; ++b)
+		{
+			char c = (char)b;
+			t->single[b - 0x80] = (unsigned short)decode_one(cd, &c, 1);
+		}
+		for (unsigned int l=c_lead_min; l<=c_lead_max; ++l)
+		{
+			for (unsigned int r=c_trail_min; r<=c_trail_max; ++r)
+			{
+				char c[2] = { (char)l, (char)r };
+				t->pair[(l - c_lead_min) * c_trail_num + r - c_trail_min] = (unsigned short)decode_one(cd, c, 2);
+			}
+		}
+		libiconv_close(cd);
+		return t;
+	}
+
+	// length of the leading run of ASCII bytes
+	static size_t ascii_run(const unsigned char *p, size_t n)
+	{
+		size_t i = 0;
+#ifdef __SSE2__
+		for (; i + 16 <= n; i += 16)
+		{
+			int mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(p + i)));
+			if (mask)
+				return i + __builtin_ctz(mask);
+		}
+#else
+		for (; i + 8 <= n; i += 8)
+		{
+			unsigned long long w;
+			memcpy(&w, p + i, 8);
+			if (w & 0x8080808080808080ULL)
+				break;
+		}
+#endif
+		while (i < n && p[i] < 0x80)
+			++i;
+		return i;
+	}
+
+	static char *put_utf8(char *out, unsigned int cp)
+	{
+		if (cp < 0x800)
+		{
+			*out++ = (char)(0xc0 | (cp >> 6));
+		}
+		else
+		{
+			*out++ = (char)(0xe0 | (cp >> 12));
+			*out++ = (char)(0x80 | ((cp >> 6) & 0x3f));
+		}
+		*out++ = (char)(0x80 | (cp & 0x3f));
+		return out;
+	}
+
+	encoding_converter::encoding_converter()
+		: _cd(libiconv_t(-1)), _table(NULL), _carry_len(0), _invalid(0)
+	{
+	}
+
+	encoding_converter::~encoding_converter()
+	{
+		close();
+	}
+
+	bool encoding_converter::open(const std::string& encoding)
+	{
+		close();
+		if (encoding.empty() || encoding == "UTF-8")
+			return false;
+
+		_cd = libiconv_open("UTF-8", encoding.c_str());
+		if (_cd == libiconv_t(-1))
+		{
+			printf("pos_net: libiconv_open(to=[UTF-8], from=[%s]) failed !\n", encoding.c_str());
+			return false;
+		}
+		_encoding = encoding;
+		_table = get_dbcs_table(encoding);
+		return true;
+	}
+
+	void encoding_converter::close()
+	{
+		if (_cd != libiconv_t(-1))
+		{
+			libiconv_close(_cd);
+			_cd = libiconv_t(-1);
+		}
+		_encoding.clear();
+		_table = NULL;
+		_carry_len = 0;
+	}
+
+	void encoding_converter::reset()
+	{
+		if (_cd != libiconv_t(-1))
+			libiconv(_cd, NULL, NULL, NULL, NULL);
+		_carry_len = 0;
+	}
+
+	// out has no room for the rest of in
+	void encoding_converter::drop(char *&in, size_t& in_left)
+	{
+		_invalid += in_left;
+		in += in_left;
+		in_left = 0;
+	}
+
+	// converts until in is used up or ends in an incomplete sequence, returns the bytes left over
+	size_t encoding_converter::convert_some(char *&in, size_t& in_left, char *&out, char *out_end)
+	{
+		if (!_table)
+			return iconv_some(in, in_left, out, out_end);
+
+		const dbcs_table& t = *_table;
+		while (in_left)
+		{
+			const unsigned char *p = (const unsigned char *)in;
+			size_t run = ascii_run(p, in_left);
+			if ((size_t)(out_end - out) < std::max(run, (size_t)3))
+			{
+				drop(in, in_left);
+				break;
+			}
+			if (run)
+			{
+				memcpy(out, in, run);
+				out += run;
+				in += run;
+				in_left -= run;
+				continue;
+			}
+
+			unsigned int cp = t.single[p[0] - 0x80];
+			size_t len = 1;
+			if (!cp && in_left >= 2 && p[1] >= c_trail_min && p[1] <= c_trail_max && p[0] >= c_lead_min && p[0] <= c_lead_max)
+			{
+				cp = t.pair[(p[0] - c_lead_min) * c_trail_num + p[1] - c_trail_min];
+				len = 2;
+			}
+			if (cp)
+			{
+				out = put_utf8(out, cp);
+				in += len;
+				in_left -= len;
+				continue;
+			}
+
+			// invalid bytes, four byte GB18030 sequences and a character cut by the end of
+			// the input are left to libiconv, within a window as long as the longest sequence
+			size_t window = std::min(in_left, (size_t)4);
+			size_t left = window;
+			char *from = in;
+			iconv_some(in, left, out, out_end);
+			if (in == from)
+			{
+				if (window == in_left)
+					break;
+				*out++ = '?';
+				++_invalid;
+				++in;
+				left = window - 1;
+			}
+			in_left -= window - left;
+		}
+		return in_left;
+	}
+
+	size_t encoding_converter::iconv_some(char *&in, size_t& in_left, char *&out, char *out_end)
+	{
+		while (in_left)
+		{
+			size_t out_left = out_end - out;
+			if (libiconv(_cd, &in, &in_left, &out, &out_left) != (size_t)-1)
+				break;
+			if (errno == EINVAL)
+				break;
+			if (errno == E2BIG || out == out_end)
+			{
+				drop(in, in_left);
+				break;
+			}
+			// EILSEQ : substitute the byte and resync on the next one
+			*out++ = '?';
+			++_invalid;
+			++in;
+			--in_left;
+		}
+		return in_left;
+	}
+
+	size_t encoding_converter::convert(const char *in, size_t n, char *out)
+	{
+		if (!active())
+		{
+			memcpy(out, in, n);
+			return n;
+		}
+
+		char *o = out;
+		char *end = out + max_output(n);
+		char *i = (char *)in;
+		if (_carry_len)
+		{
+			// complete the split character with the head of the new bytes
+			size_t take = std::min(n, c_max_carry - _carry_len);
+			memcpy(_carry + _carry_len, in, take);
+			char *c = _carry;
+			size_t c_left = _carry_len + take;
+			convert_some(c, c_left, o, end);
+			size_t used = c - _carry;
+			if (used < _carry_len)
+			{
+				if (take == n)
+				{
+					// still incomplete, everything stays carried
+					memmove(_carry, c, c_left);
+					_carry_len = c_left;
+					return o - out;
+				}
+				// no encoding has sequences this long, give up on the carried bytes
+				*o++ = '?';
+				++_invalid;
+				used = _carry_len;
+			}
+			i += used - _carry_len;
+			n -= used - _carry_len;
+			_carry_len = 0;
+		}
+
+		size_t left = convert_some(i, n, o, end);
+		if (left)
+		{
+			memcpy(_carry, i, std::min(left, c_max_carry));
+			_carry_len = std::min(left, c_max_carry);
+		}
+		return o - out;
+	}
+}
@@ -0,0 +1,62 @@
+#ifndef __pos_encoding_h__
+#define __pos_encoding_h__
+
+#include <string>
+#include "iconv.h"
+
+namespace pos_net
+{
+	struct dbcs_table;
+
+	// streaming conversion to UTF-8 that keeps the iconv shift state and the bytes of a
+	// multibyte character split across reads, so every received byte is converted once;
+	// GBK, GB18030, Big5 and their aliases are decoded from lookup tables with an ASCII
+	// run skip, libiconv handles the rest
+	struct encoding_converter
+	{
+		encoding_converter();
+		~encoding_converter();
+
+		// false for UTF-8 (nothing to convert) or an encoding libiconv does not know
+		bool open(const std::string& encoding);
+		void close();
+		bool active() const { return _cd != libiconv_t(-1); }
+		const std::string& encoding() const { return _encoding; }
+
+		// drops the carried bytes and the shift state, for a new connection
+		void reset();
+
+		static const size_t c_max_carry = 8;
+		// UTF-8 bytes per input byte: a lone CP936 0x80 is the 3 byte euro sign, 4 leaves room for what
+		// libiconv may emit for an encoding without a table
+		static const size_t c_max_ratio = 4;
+
+		// out needs room for max_output(n) bytes
+		static size_t max_output(size_t n) { return (n + c_max_carry) * c_max_ratio; }
+
+		// converts in[0,n) following the carried bytes, returns the bytes written to out;
+		// an incomplete trailing sequence is carried, an invalid byte becomes '?', input that
+		// would not fit in max_output(n) is dropped and counted as invalid
+		size_t convert(const char *in, size_t n, char *out);
+
+		// running count of bytes replaced by '?'
+		unsigned long invalid() const { return _invalid; }
+
+	private:
+		encoding_converter(const encoding_converter&);
+		encoding_converter& operator=(const encoding_converter&);
+
+		size_t convert_some(char *&in, size_t& in_left, char *&out, char *out_end);
+		size_t iconv_some(char *&in, size_t& in_left, char *&out, char *out_end);
+		void drop(char *&in, size_t& in_left);
+
+		libiconv_t _cd;
+		const dbcs_table *_table;	// table-driven fast path, NULL = libiconv only
+		std::string _encoding;
+		char _carry[c_max_carry];
+		size_t _carry_len;
+		unsigned long _invalid;
+	};
+}
+
+#endif // __pos_encoding_h__
@@ -0,0 +1,176 @@
+#include "pos_event_queue.h"
+#include "pos_metrics.h"
+#include "pos_terminal_parser.h"
+#include <boost/bind.hpp>
+#include <algorithm>
+
+namespace pos_net
+{
+	event_queue::event_queue(event_dispatcher *owner, size_t depth, e_overflow overflow)
+		: _owner(owner), _slots(depth ? depth : 1), _overflow(overflow),
+		_head(0), _tail(0), _high_water(0), _dropped(0)
+	{
+	}
+
+	bool event_queue::push(e_callback_type type, const char *item, const terminal_record *rec)
+	{
+		size_t head = _head.load(boost::memory_order_relaxed);
+		while (head - _tail.load(boost::memory_order_acquire) >= _slots.size())
+		{
+			if (_overflow == OVERFLOW_DROP || _owner->stopping())
+			{
+				_dropped.store(_dropped.load(boost::memory_order_relaxed) + 1, boost::memory_order_relaxed);
+				return false;
+			}
+			_owner->wake();
+			ho::thread::sleep(1);
+		}
+
+		event& e = _slots[head % _slots.size()];
+		e.type = type;
+		e.has_item = item != NULL;
+		e.has_record = rec != NULL;
+		if (item)
+			e.item.assign(item);
+		else if (rec)
+			e.item.assign((const char *)rec, sizeof(*rec));
+		_head.store(head + 1);
+
+		size_t depth = head + 1 - _tail.load(boost::memory_order_relaxed);
+		if (depth > _high_water.load(boost::memory_order_relaxed))
+			_high_water.store(depth, boost::memory_order_relaxed);
+		_owner->wake();
+		return true;
+	}
+
+	event_queue::event *event_queue::front(size_t i)
+	{
+		size_t tail = _tail.load(boost::memory_order_relaxed);
+		if (_head.load(boost::memory_order_acquire) - tail <= i)
+			return NULL;
+		return &_slots[(tail + i) % _slots.size()];
+	}
+
+	void event_queue::pop(size_t n)
+	{
+		_tail.store(_tail.load(boost::memory_order_relaxed) + n, boost::memory_order_release);
+	}
+
+	event_dispatcher::event_dispatcher(void (*callback)(e_callback_type, const char *, void *),
+		void (*batch_callback)(const item_view *, size_t, void *), void *user_parm,
+		ingest_counters *metrics)
+		: _callback(callback), _batch_callback(batch_callback), _user_parm(user_parm), _metrics(metrics), _sleeping(false), _stopping(false), _dispatched(0)
+	{
+	}
+
+	event_dispatcher::~event_dispatcher()
+	{
+		stop();
+		for (size_t i=0; i<_queues.size(); ++i)
+			delete _queues[i];
+	}
+
+	event_queue *event_dispatcher::add_queue(size_t depth, e_overflow overflow)
+	{
+		_queues.push_back(new event_queue(this, depth, overflow));
+		return _queues.back();
+	}
+
+	void event_dispatcher::start()
+	{
+		_thread = boost::bind(&event_dispatcher::run, this);
+	}
+
+	void event_dispatcher::stop()
+	{
+		if (_stopping.exchange(true))
+			return;
+		_event.notify();
+		_thread.join();
+	}
+
+	void event_dispatcher::wake()
+	{
+		// seq_cst against the store in run, either the producer sees the sleeper or the sleeper sees the event
+		if (_sleeping.load() && _sleeping.exchange(false))
+			_event.notify();
+	}
+
+	bool event_dispatcher::drain()
+	{
+		bool any = false;
+		for (size_t i=0; i<_queues.size(); ++i)
+		{
+			event_queue *q = _queues[i];
+			if (_batch_callback)
+			{
+				// the slots stay untouched by the producer until popped
+				for (event_queue::event *e; (e = q->front(_batch.size())) != NULL; )
+				{
+					item_view v = { e->type, e->has_item ? e->item.c_str() : NULL, e->has_item ? e->item.size() : 0,
+						e->has_record ? (const terminal_record *)e->item.data() : NULL };
+					_batch.push_back(v);
+				}
+				if (_batch.empty())
+					continue;
+				unsigned long long t = monotonic_us();
+				_batch_callback(&_batch[0], _batch.size(), _user_parm);
+				_metrics->add_latency(monotonic_us() - t);
+				q->pop(_batch.size());
+				_dispatched.fetch_add(_batch.size(), boost::memory_order_relaxed);
+				_batch.clear();
+				any = true;
+				continue;
+			}
+			while (event_queue::event *e = q->front())
+			{
+				if (_callback)
+				{
+					unsigned long long t = monotonic_us();
+					_callback(e->type, e->has_item ? e->item.c_str() : NULL, _user_parm);
+					_metrics->add_latency(monotonic_us() - t);
+				}
+				q->pop();
+				_dispatched.fetch_add(1, boost::memory_order_relaxed);
+				any = true;
+			}
+		}
+		return any;
+	}
+
+	void event_dispatcher::run()
+	{
+		for (;;)
+		{
+			if (drain())
+				continue;
+			if (_stopping.load())
+			{
+				drain();
+				break;
+			}
+			_sleeping.store(true);
+			if (drain() || _stopping.load())
+			{
+				_sleeping.store(false);
+				continue;
+			}
+			_event.wait();
+			_sleeping.store(false);
+		}
+	}
+
+	void event_dispatcher::get_stats(dispatch_stats& stats) const
+	{
+		stats.depth = 0;
+		stats.high_water = 0;
+		stats.dropped = 0;
+		for (size_t i=0; i<_queues.size(); ++i)
+		{
+			stats.depth += _queues[i]->size();
+			stats.high_water = std::max(stats.high_water, _queues[i]->high_water());
+			stats.dropped += _queues[i]->dropped();
+		}
+		stats.dispatched = _dispatched.load(boost::memory_order_relaxed);
+	}
+}
@@ -0,0 +1,90 @@
+#ifndef __pos_event_queue_h__
+#define __pos_event_queue_h__
+
+#include <string>
+#include <vector>
+#include <boost/atomic.hpp>
+#include "net_driver.h"
+#include "pos_net.h"
+
+namespace pos_net
+{
+	struct event_dispatcher;
+	struct ingest_counters;
+
+	// bounded single producer (io shard) / single consumer (dispatch thread) ring of callback
+	// events, the producer never takes a lock and the slots keep their capacity between rounds
+	struct event_queue : boost::noncopyable
+	{
+		struct event
+		{
+			e_callback_type type;
+			bool has_item;
+			bool has_record;
+			std::string item;		// or the bytes of the terminal_record
+		};
+
+		event_queue(event_dispatcher *owner, size_t depth, e_overflow overflow);
+
+		// producer, false when the event was dropped by OVERFLOW_DROP; rec (parm::terminal_records) is copied in place of item
+		bool push(e_callback_type type, const char *item, const terminal_record *rec = NULL);
+
+		// consumer, the i-th pending event or NULL
+		event *front(size_t i = 0);
+		void pop(size_t n = 1);
+
+		size_t size() const { return _head.load() - _tail.load(); }
+		size_t high_water() const { return _high_water.load(boost::memory_order_relaxed); }
+		unsigned long dropped() const { return _dropped.load(boost::memory_order_relaxed); }
+
+	private:
+		event_dispatcher *_owner;
+		std::vector<event> _slots;
+		e_overflow _overflow;
+		boost::atomic<size_t> _head;	// next slot to fill, written by the producer
+		boost::atomic<size_t> _tail;	// next slot to dispatch, written by the consumer
+		boost::atomic<size_t> _high_water;
+		boost::atomic<unsigned long> _dropped;
+	};
+
+	// runs the callback of one pos_net::start handle on its own thread, draining the
+	// queues of all its servers so rendering or database work never stalls a read
+	struct event_dispatcher : boost::noncopyable
+	{
+		event_dispatcher(void (*callback)(e_callback_type, const char *, void *),
+			void (*batch_callback)(const item_view *, size_t, void *), void *user_parm,
+			ingest_counters *metrics);
+		~event_dispatcher();
+
+		// before start, the dispatcher owns the queue
+		event_queue *add_queue(size_t depth, e_overflow overflow);
+
+		void start();
+		// delivers what is still queued and joins the thread, producers must be stopped
+		void stop();
+
+		// producer side, wakes the thread if it sleeps
+		void wake();
+		bool stopping() const { return _stopping.load(); }
+
+		void get_stats(dispatch_stats& stats) const;
+
+	private:
+		void run();
+		bool drain();
+
+		void (*_callback)(e_callback_type, const char *, void *);
+		void (*_batch_callback)(const item_view *, size_t, void *);
+		void *_user_parm;
+		ingest_counters *_metrics;	// callback latency
+		std::vector<item_view> _batch;
+		std::vector<event_queue *> _queues;
+		ho::thread _thread;
+		ho::event _event;
+		boost::atomic<bool> _sleeping;
+		boost::atomic<bool> _stopping;
+		boost::atomic<unsigned long long> _dispatched;
+	};
+}
+
+#endif // __pos_event_queue_h__
@@ -0,0 +1,233 @@
+#include "pos_loadgen.h"
+#include "pos_metrics.h"
+#include "pos_terminal_parser.h"
+#include "net_driver.h"
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/ip/udp.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/typeof/typeof.hpp>
+#include <algorithm>
+#include <map>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace pos_net
+{
+	// product names, GBK and UTF-8
+	static const char *s_products[][2] =
+	{
+		{ "\xc5\xa3\xc4\xcc", "\xe7\x89\x9b\xe5\xa5\xb6" },
+		{ "\xc3\xe6\xb0\xfc", "\xe9\x9d\xa2\xe5\x8c\x85" },
+		{ "\xc6\xbb\xb9\xfb", "\xe8\x8b\xb9\xe6\x9e\x9c" },
+		{ "\xbf\xc9\xc0\xd6", "\xe5\x8f\xaf\xe4\xb9\x90" },
+		{ "\xcf\xe3\xd1\xcc", "\xe9\xa6\x99\xe7\x83\x9f" },
+		{ "\xbf\xf3\xc8\xaa\xcb\xae", "\xe7\x9f\xbf\xe6\xb3\x89\xe6\xb0\xb4" }
+	};
+
+	// transactions carry "@<sequence>" inside an item, in the serial of a DPOS frame, whose 8 characters
+	// bound it to c_seq_mod; the send time stays here
+	static const unsigned long c_seq_mod = 10000000;
+
+	struct load_sink
+	{
+		ho::mutex _mutex;
+		std::map<unsigned long, unsigned long long> _sent_us;	// by sequence, until delivered
+		std::vector<unsigned long long> _latency_us;
+
+		void sent(unsigned long seq)
+		{
+			unsigned long long now = monotonic_us();
+			ho::lock_guard lock(_mutex);
+			_sent_us[seq] = now;
+		}
+
+		static void on_event(e_callback_type type, const char *item, void *user_parm)
+		{
+			if (type != CALLBACK_TYPE_ITEM || !item)
+				return;
+			load_sink *s = (load_sink *)user_parm;
+			for (const char *p = strchr(item, '@'); p; p = strchr(p + 1, '@'))
+			{
+				char *end;
+				unsigned long seq = strtoul(p + 1, &end, 10);
+				if (end == p + 1)
+					continue;
+				unsigned long long now = monotonic_us();
+				ho::lock_guard lock(s->_mutex);
+				BOOST_AUTO(it, s->_sent_us.find(seq));
+				if (it == s->_sent_us.end())
+					continue;
+				s->_latency_us.push_back(now > it->second ? now - it->second : 0);
+				s->_sent_us.erase(it);
+			}
+		}
+
+		size_t delivered()
+		{
+			ho::lock_guard lock(_mutex);
+			return _latency_us.size();
+		}
+
+		// the latencies of the step, what is still undelivered counts as lost
+		void take(std::vector<unsigned long long>& v)
+		{
+			ho::lock_guard lock(_mutex);
+			v.swap(_latency_us);
+			_latency_us.clear();
+			_sent_us.clear();
+		}
+	};
+
+	struct load_register
+	{
+		boost::shared_ptr<boost::asio::ip::tcp::socket> _tcp;
+		boost::shared_ptr<boost::asio::ip::udp::socket> _udp;
+		unsigned long _seq;
+	};
+
+	// one transaction of register r in the framing of p.server, key is its sequence of all registers
+	static std::string make_transaction(const load_parm& p, unsigned int r, unsigned long seq, unsigned long key)
+	{
+		const parm& s = p.server;
+		int cs = s.encoding.empty() ? 1 : 0;
+		std::string stamp = "@" + boost::lexical_cast<std::string>(key);
+		if (s.type == POS_TYPE_TERMINAL)
+		{
+			std::string fields[6] =
+			{
+				boost::lexical_cast<std::string>(r + 1),
+				boost::lexical_cast<std::string>(6222000000000000ULL + seq),
+				boost::lexical_cast<std::string>(seq % 1000) + ".50",
+				"4",
+				stamp,
+				"20170417112459"
+			};
+			return make_terminal_msg(fields);
+		}
+		if (s.type == POS_TYPE_PLAINTEXT)
+			return boost::lexical_cast<std::string>(r + 1) + " " + s_products[seq % 6][cs] + " x1 " + stamp + "\n";
+
+		std::string ret = s.start_tag + s.item_sep;
+		for (unsigned int i=0; i<p.items; ++i)
+		{
+			ret += s_products[(seq + i) % 6][cs];
+			ret += " x" + boost::lexical_cast<std::string>(i % 3 + 1) + " " + boost::lexical_cast<std::string>(i + 2) + ".50" + s.item_sep;
+		}
+		ret += stamp + s.item_sep + s.stop_tag + s.item_sep;
+		return ret;
+	}
+
+	static unsigned long long percentile(const std::vector<unsigned long long>& v, double q)
+	{
+		return v.empty() ? 0 : v[std::min(v.size() - 1, (size_t)(v.size() * q))];
+	}
+
+	bool load_test(const load_parm& p, load_report& report)
+	{
+		using namespace boost::asio::ip;
+		report.steps.clear();
+		report.max_sustained_tps = 0;
+		if (!p.registers || p.rate <= 0 || (p.server.proto != PROTO_TCP && p.server.proto != PROTO_UDP))
+		{
+			printf("[pos_net] load_test needs registers, a rate and tcp or udp\n");
+			return false;
+		}
+
+		load_sink sink;
+		parm sp = p.server;
+		sp.callback = &load_sink::on_event;
+		sp.batch_callback = NULL;
+		sp.user_parm = &sink;
+		if (sp.max_sessions && sp.max_sessions < p.registers)
+			sp.max_sessions = 0;
+		void *server = start(sp);
+		if (!server)
+			return false;
+
+		bool ok = true;
+		boost::asio::io_service io;
+		std::vector<load_register> regs(p.registers);
+		address_v4 local = address_v4::loopback();
+		try
+		{
+			// the listener starts on its io shard
+			usleep(50000);
+			for (size_t i=0; i<regs.size(); ++i)
+			{
+				regs[i]._seq = 0;
+				if (sp.proto == PROTO_TCP)
+				{
+					regs[i]._tcp.reset(new tcp::socket(io));
+					regs[i]._tcp->connect(tcp::endpoint(local, sp.port));
+					regs[i]._tcp->set_option(tcp::no_delay(true));
+				}
+				else
+					regs[i]._udp.reset(new udp::socket(io, udp::endpoint(udp::v4(), 0)));
+			}
+
+			unsigned long key_seq = 0;
+			double rate = p.rate;
+			for (unsigned int step=0; step<std::max(p.steps, 1U); ++step, rate *= p.ramp)
+			{
+				load_step r;
+				memset(&r, 0, sizeof(r));
+				double interval_us = 1000000.0 / (rate * regs.size());
+				unsigned long long begin = monotonic_us();
+				unsigned long long end = begin + p.step_ms * 1000ULL;
+				unsigned long long now = begin;
+				for (unsigned long i=0; now < end; ++i)
+				{
+					unsigned long long due = begin + (unsigned long long)(i * interval_us);
+					if (due >= end)
+						break;
+					if (due > now + 100)
+						usleep((useconds_t)(due - now));
+					load_register& reg = regs[i % regs.size()];
+					unsigned long key = key_seq++ % c_seq_mod;
+					std::string t = make_transaction(p, (unsigned int)(i % regs.size()), reg._seq++, key);
+					sink.sent(key);
+					if (reg._tcp)
+						boost::asio::write(*reg._tcp, boost::asio::buffer(t));
+					else
+						reg._udp->send_to(boost::asio::buffer(t), udp::endpoint(local, sp.port));
+					++r.sent;
+					now = monotonic_us();
+				}
+				double secs = (now - begin) / 1000000.0;
+				r.offered_tps = r.sent / secs;
+
+				// stragglers get a second
+				for (int i=0; i<100 && sink.delivered() < r.sent; ++i)
+					usleep(10000);
+				std::vector<unsigned long long> lat;
+				sink.take(lat);
+				std::sort(lat.begin(), lat.end());
+				r.delivered_tps = lat.size() / secs;
+				r.lost = lat.size() < r.sent ? r.sent - lat.size() : 0;
+				r.p50_us = percentile(lat, 0.5);
+				r.p90_us = percentile(lat, 0.9);
+				r.p99_us = percentile(lat, 0.99);
+				r.p999_us = percentile(lat, 0.999);
+				r.max_us = lat.empty() ? 0 : lat.back();
+				r.sustained = !r.lost && r.offered_tps >= rate * regs.size() * 0.95;
+				report.steps.push_back(r);
+				if (!r.sustained)
+					break;
+				report.max_sustained_tps = std::max(report.max_sustained_tps, r.offered_tps);
+				if (p.ramp <= 1)
+					break;
+			}
+		}
+		catch (const std::exception& e)
+		{
+			printf("[pos_net] load_test error(%s)\n", e.what());
+			ok = false;
+		}
+		regs.clear();
+		stop(&server);
+		return ok;
+	}
+}
@@ -0,0 +1,53 @@
+#ifndef __pos_loadgen_h__
+#define __pos_loadgen_h__
+
+#include <string>
+#include <vector>
+#include "pos_net.h"
+
+namespace pos_net
+{
+	// synthetic registers over localhost against a pos_net::start of server, every transaction carries a
+	// sequence its send time is kept by, so the latency covers the socket, framing, decoding and the
+	// dispatch queue up to the callback
+	struct load_parm
+	{
+		load_parm() : registers(100), items(8), rate(1), ramp(2), steps(8), step_ms(2000) {}
+
+		// type, proto (PROTO_TCP or PROTO_UDP), port, tags, encoding ("GBK" : registers send GBK content),
+		// listeners, queue_depth and backend are taken as they are, the callbacks are the generator's own
+		// POS_TYPE_TERMINAL sends a DPOS frame per transaction
+		parm server;
+		unsigned int registers;	// simulated registers, a tcp connection / udp socket each
+		unsigned int items;		// items per receipt
+		double rate;			// transactions per second of each register in the first step
+		double ramp;			// rate factor of each following step, the ramp stops at the first step that falls behind
+		unsigned int steps;
+		unsigned int step_ms;
+	};
+
+	struct load_step
+	{
+		double offered_tps;		// transactions sent per second, all registers
+		double delivered_tps;
+		unsigned long sent;
+		unsigned long lost;		// not delivered within a second after the step
+		unsigned long long p50_us;
+		unsigned long long p90_us;
+		unsigned long long p99_us;
+		unsigned long long p999_us;
+		unsigned long long max_us;
+		bool sustained;			// the registers kept their pace and nothing was lost
+	};
+
+	struct load_report
+	{
+		std::vector<load_step> steps;
+		double max_sustained_tps;
+	};
+
+	// blocks for the whole ramp, false when the server or the registers could not start
+	bool load_test(const load_parm& p, load_report& report);
+}
+
+#endif // __pos_loadgen_h__
@@ -0,0 +1,87 @@
+#ifndef __pos_metrics_h__
+#define __pos_metrics_h__
+
+#include <time.h>
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+#include "pos_net.h"
+
+namespace pos_net
+{
+	inline unsigned long long monotonic_us()
+	{
+		timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	}
+
+	// ingest counters of one pos_net::start handle, bumped with relaxed atomics by every
+	// io shard and the dispatch thread, read without a lock by get_ingest_stats
+	struct ingest_counters : boost::noncopyable
+	{
+		typedef boost::atomic<unsigned long long> counter;
+
+		counter bytes;
+		counter items;
+		counter transactions;
+		counter resyncs;
+		counter encoding_errors;
+		counter overflows;
+		counter udp_drops;
+		counter timed_out;
+		counter idle_closed;
+		counter port_errors;
+		counter callbacks;
+		counter latency_us[ingest_stats::c_latency_buckets];
+		counter max_latency_us;
+		unsigned long long started_us;
+
+		ingest_counters() : started_us(monotonic_us())
+		{
+			counter *all[] = { &bytes, &items, &transactions, &resyncs, &encoding_errors, &overflows, &udp_drops, &timed_out, &idle_closed, &port_errors, &callbacks, &max_latency_us };
+			for (size_t i=0; i<sizeof(all)/sizeof(all[0]); ++i)
+				all[i]->store(0, boost::memory_order_relaxed);
+			for (size_t i=0; i<ingest_stats::c_latency_buckets; ++i)
+				latency_us[i].store(0, boost::memory_order_relaxed);
+		}
+
+		static void add(counter& c, unsigned long long n = 1)
+		{
+			c.fetch_add(n, boost::memory_order_relaxed);
+		}
+
+		// one callback (or batch) that ran for us microseconds
+		void add_latency(unsigned long long us)
+		{
+			size_t b = 0;
+			while ((us >> (b + 1)) && b + 1 < ingest_stats::c_latency_buckets)
+				++b;
+			add(callbacks);
+			add(latency_us[b]);
+			unsigned long long m = max_latency_us.load(boost::memory_order_relaxed);
+			while (us > m && !max_latency_us.compare_exchange_weak(m, us, boost::memory_order_relaxed))
+				;
+		}
+
+		void get(ingest_stats& s) const
+		{
+			s.bytes = bytes.load(boost::memory_order_relaxed);
+			s.items = items.load(boost::memory_order_relaxed);
+			s.transactions = transactions.load(boost::memory_order_relaxed);
+			s.resyncs = resyncs.load(boost::memory_order_relaxed);
+			s.encoding_errors = encoding_errors.load(boost::memory_order_relaxed);
+			s.overflows = overflows.load(boost::memory_order_relaxed);
+			s.udp_drops = udp_drops.load(boost::memory_order_relaxed);
+			s.timed_out = timed_out.load(boost::memory_order_relaxed);
+			s.idle_closed = idle_closed.load(boost::memory_order_relaxed);
+			s.port_errors = port_errors.load(boost::memory_order_relaxed);
+			s.callbacks = callbacks.load(boost::memory_order_relaxed);
+			for (size_t i=0; i<ingest_stats::c_latency_buckets; ++i)
+				s.latency_us[i] = latency_us[i].load(boost::memory_order_relaxed);
+			s.max_latency_us = max_latency_us.load(boost::memory_order_relaxed);
+			s.uptime_ms = (monotonic_us() - started_us) / 1000;
+		}
+	};
+}
+
+#endif // __pos_metrics_h__
@@ -2,11 +2,32 @@
 #include "net_driver.h"
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/ip/udp.hpp>
-#include <boost/algorithm/string.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
 #include <boost/typeof/typeof.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/unordered_map.hpp>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <set>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#define POS_NET_RECVMMSG
+#endif
 #include "pos_net.h"
 #include "pos_terminal_parser.h"
-#include "iconv.h"
+#include "pos_tag_matcher.h"
+#include "pos_encoding.h"
+#include "pos_event_queue.h"
+#include "pos_metrics.h"
+#include "pos_capture.h"
+#include "pos_timer_wheel.h"
+#include "pos_uring.h"
 
 namespace pos_net
 {
@@ -15,138 +36,667 @@ namespace pos_net
 
 	using namespace boost::asio::ip;
 
-	static const size_t c_max_line = 512;
+	static const size_t c_max_line = 512;	// initial buffer size and minimum free space per read
+
+	// growable receive buffer, consumed bytes are reclaimed lazily so framing never moves data per read
+	struct line_buffer
+	{
+		std::vector<char> _data;
+		size_t _begin;
+		size_t _end;
+		size_t _max;
+
+		line_buffer() : _data(c_max_line + 1), _begin(0), _end(0), _max(c_max_line)
+		{
+			_data[0] = '\0';
+		}
+
+		char *data() { return &_data[_begin]; }
+		size_t size() const { return _end - _begin; }
+		char *tail() { return &_data[_end]; }
+		size_t tail_size() const { return _data.size() - 1 - _end; }
+
+		// makes room for at least min_space bytes, false once the pending bytes reach the cap
+		bool reserve(size_t min_space = c_max_line)
+		{
+			if (tail_size() >= min_space)
+				return true;
+			if (size() >= _max)
+				return false;
+			// compact only once the consumed head outweighs the pending bytes, amortized O(1) per byte
+			if (_begin && _begin >= size())
+			{
+				memmove(&_data[0], data(), size() + 1);
+				_end -= _begin;
+				_begin = 0;
+				if (tail_size() >= min_space)
+					return true;
+			}
+			size_t n = std::max(std::min((_data.size() - 1) * 2, _max), _end + min_space);
+			_data.resize(n + 1);
+			return true;
+		}
+
+		void commit(size_t n)
+		{
+			_end += n;
+			_data[_end] = '\0';
+		}
+
+		void consume(size_t n)
+		{
+			_begin += n;
+			if (_begin == _end)
+				clear();
+		}
+
+		void clear()
+		{
+			_begin = _end = 0;
+			_data[0] = '\0';
+		}
+	};
+
+#ifdef SO_REUSEPORT
+	typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port;
+#endif
+
+	template <typename Socket, typename Endpoint>
+	static void open_shared(Socket& s, const Endpoint& ep, bool reuseport)
+	{
+		s.open(ep.protocol());
+		s.set_option(boost::asio::socket_base::reuse_address(true));
+		if (reuseport)
+		{
+#ifdef SO_REUSEPORT
+			s.set_option(reuse_port(true));
+#else
+			throw std::runtime_error("SO_REUSEPORT not supported");
+#endif
+		}
+		s.bind(ep);
+	}
+
+	// framing state and accounting of one byte stream (a tcp session or a udp socket)
+	struct stream : boost::noncopyable
+	{
+		bool _has_started;
+		tag_matcher::state _scan;
+		encoding_converter _cvt;
+		std::vector<char> _raw;		// read target while _cvt is active
+		line_buffer _in;			// UTF-8 bytes waiting to be framed
+		unsigned long long _bytes;
+		unsigned long _items;
+		unsigned long _transactions;
+		unsigned long _drops;
+		unsigned long _truncated;
+		unsigned long _frames;
+		unsigned long _resyncs;
+		unsigned long _max_rx_delay_us;
+		unsigned int _capture_id;	// 0 until the first captured read
+		unsigned int _framing;		// server_base::_framing this stream was set up for
+		timer_wheel *_wheel;		// of the server owning the stream
+		timer_wheel::entry _timer;	// next idle or transaction timeout, moved lazily
+		unsigned long long _rx_tick;	// wheel tick of the last read
+		unsigned long long _start_tick;	// wheel tick of the start tag of the open transaction
+
+		stream() : _framing(0), _wheel(NULL), _timer(this), _rx_tick(0), _start_tick(0) { reset(); }
+
+		void reset()
+		{
+			_has_started = false;
+			_scan.reset();
+			_cvt.reset();
+			_in.clear();
+			_bytes = 0;
+			_items = 0;
+			_transactions = 0;
+			_drops = 0;
+			_truncated = 0;
+			_frames = 0;
+			_resyncs = 0;
+			_max_rx_delay_us = 0;
+			_capture_id = 0;
+		}
+
+		void get_stats(session_stats& r) const
+		{
+			r.bytes = _bytes;
+			r.items = _items;
+			r.transactions = _transactions;
+			r.drops = _drops;
+			r.truncated = _truncated;
+			r.frames = _frames;
+			r.resyncs = _resyncs;
+			r.max_rx_delay_us = _max_rx_delay_us;
+		}
+	};
+
+#ifdef POS_NET_URING
+	// the uring of shard for a BACKEND_URING server, NULL keeps it on the reactor
+	static uring *open_uring(const parm& p, size_t shard)
+	{
+		if (p.backend != BACKEND_URING)
+			return NULL;
+		uring *u = uring::instance(service::get_io_service(shard));
+		if (!u)
+			printf("[pos_net] io_uring unavailable, port %d stays on the reactor\n", p.port);
+		return u;
+	}
+#endif
+
+	struct route;
+
+	// devices of a shared port by source, exact ip:port first, then any port of the ip, then 0.0.0.0
+	struct route_table
+	{
+		typedef boost::unordered_map<unsigned long long, route *> map_type;
+		map_type _map;
+
+		static unsigned long long key(unsigned long ip, unsigned short port)
+		{
+			return ((unsigned long long)ip << 16) | port;
+		}
+
+		void add(unsigned long long k, route *r)
+		{
+			_map[k] = r;
+		}
+
+		void remove(route *r)
+		{
+			for (map_type::iterator it = _map.begin(); it != _map.end(); )
+			{
+				if (it->second == r)
+					it = _map.erase(it);
+				else
+					++it;
+			}
+		}
+
+		route *find(unsigned long long k) const
+		{
+			map_type::const_iterator it = _map.find(k);
+			return it == _map.end() ? NULL : it->second;
+		}
+
+		route *find(const address& a, unsigned short port) const
+		{
+			if (_map.empty() || !a.is_v4())
+				return NULL;
+			unsigned long ip = a.to_v4().to_ulong();
+			map_type::const_iterator it = _map.find(key(ip, port));
+			if (it == _map.end())
+				it = _map.find(key(ip, 0));
+			if (it == _map.end())
+				it = _map.find(key(0, 0));
+			return it == _map.end() ? NULL : it->second;
+		}
+	};
 
 	struct server_base
 	{
 		parm _parm;
-		bool _has_started;
+		size_t _shard;
+		tag_matcher _tags;
+		terminal_key _key;		// of _parm.aes_key, only replaced by set_framing on this server's thread
+		typedef void (server_base::*frame_fn)(stream& st, char *buf, size_t& size);
+		frame_fn _frame;		// framer of _parm.type, picked by init_framing so on_frame does not branch on it
+		bool _shared;			// listener of a shared port, framing is done by the route of each source
+		route_table _routes;
+		event_queue *_queue;	// parm::queue_depth, owned by the dispatcher of the server_group
+		ingest_counters *_metrics;	// those of the server_group, or _own_metrics for a shared listener
+		ingest_counters _own_metrics;
+		capture_writer *_capture;	// parm::capture_path, owned by the server_group
+		unsigned int _framing;		// bumped by set_framing
+		unsigned int _tags_framing;	// last _framing that changed the tags or the type
+		timer_wheel _wheel;			// timeouts of the streams this server owns
+
+        server_base(const parm& p, size_t shard)
+            : _parm(p), _shard(shard), _shared(false), _queue(NULL), _metrics(&_own_metrics), _capture(NULL), _framing(0), _tags_framing(0),
+			_wheel(service::get_io_service(shard), boost::bind(&server_base::on_wheel, this, _1)), _terminal_frames(0)
+		{
+			init_framing();
+		}
+
+		// off the shards, the wheel is on io
+		server_base(const parm& p, boost::asio::io_service& io)
+			: _parm(p), _shard(0), _shared(false), _queue(NULL), _metrics(&_own_metrics), _capture(NULL), _framing(0), _tags_framing(0),
+			_wheel(io, boost::bind(&server_base::on_wheel, this, _1)), _terminal_frames(0)
+		{
+			init_framing();
+		}
 
-        server_base(const parm& p)
-            : _parm(p), _has_started(false), m_cd(libiconv_t(-1))
+		void init_framing()
 		{
 			_parm.start_tag += _parm.item_sep;
+			_tags = tag_matcher(_parm.start_tag, _parm.item_sep, _parm.stop_tag);
+			_msg_cvt.close();
+			if (_parm.type == POS_TYPE_TERMINAL)
+				_msg_cvt.open(_parm.encoding);
+			if (_parm.aes_key.size() == 16)
+				_key = terminal_key((const unsigned char *)_parm.aes_key.data());
+			else
+			{
+				if (!_parm.aes_key.empty())
+					printf("[pos_net] aes_key of %d bytes ignored, not 16\n", (int)_parm.aes_key.size());
+				_key = terminal_key::builtin();
+			}
+			switch (_parm.type)
+			{
+			case POS_TYPE_RECEIPTS:
+				if (_parm.item_sep.empty())
+					_frame = &server_base::on_data_receipts<false>;
+				else
+					_frame = &server_base::on_data_receipts<true>;
+				break;
+			case POS_TYPE_TERMINAL:
+				_frame = &server_base::on_data_terminal;
+				break;
+			case POS_TYPE_PLAINTEXT:
+				_frame = &server_base::on_data_plaintext;
+				break;
+			default:
+				_frame = NULL;
+			}
+		}
 
-            if (_parm.encoding != "UTF-8")
-            {
-                m_cd = libiconv_open("UTF-8", _parm.encoding.c_str());
-                if (m_cd == libiconv_t(-1))
-                {
-                    printf("pos_net: libiconv_open(to=[UTF-8], from=[%s]) failed !\n",
-                           _parm.encoding.c_str());
-                }
-            }
+		// pos_net::reconfigure, the streams switch over once their read in flight is done
+		void set_framing(const parm& p)
+		{
+			++_framing;
+			if (p.type != _parm.type || p.start_tag + p.item_sep != _parm.start_tag || p.stop_tag != _parm.stop_tag || p.item_sep != _parm.item_sep)
+				_tags_framing = _framing;
+			_parm.type = p.type;
+			_parm.start_tag = p.start_tag;
+			_parm.stop_tag = p.stop_tag;
+			_parm.item_sep = p.item_sep;
+			_parm.encoding = p.encoding;
+			_parm.aes_key = p.aes_key;
+			_parm.max_line = p.max_line;
+			init_framing();
+		}
+
+		// terminal frames are binary, only their parsed message is converted
+		void init_stream(stream& st)
+		{
+			st._cvt.close();
+			st._framing = _framing;
+			if (_parm.type != POS_TYPE_TERMINAL && st._cvt.open(_parm.encoding))
+				st._raw.resize(c_max_line);
+		}
+
+		// the pending bytes stay, a started transaction goes on unless the tags changed
+		void refresh_stream(stream& st)
+		{
+			if (st._framing == _framing)
+				return;
+			if ((int)(_tags_framing - st._framing) > 0)
+			{
+				st._has_started = false;
+				st._scan.reset();
+			}
+			init_stream(st);
 		}
 
-		void invoke_callback(e_callback_type type, const char *item = NULL)
+		// rec : parm::terminal_records, in place of item
+		void invoke_callback(stream& st, e_callback_type type, const char *item = NULL, const terminal_record *rec = NULL)
 		{
-			if (_parm.callback)
+			if (type == CALLBACK_TYPE_ITEM)
+			{
+				++st._items;
+				ingest_counters::add(_metrics->items);
+			}
+			else if (type == CALLBACK_TYPE_STOP)
+			{
+				++st._transactions;
+				ingest_counters::add(_metrics->transactions);
+			}
+			if (_queue)
+				_queue->push(type, item, rec);
+			else if (_parm.batch_callback)
+			{
+				item_view v = { type, item, item ? strlen(item) : 0, rec };
+				_batch.push_back(v);
+			}
+			else if (_parm.callback)
+			{
+				unsigned long long t = monotonic_us();
 				_parm.callback(type, item, _parm.user_parm);
+				_metrics->add_latency(monotonic_us() - t);
+			}
 		}
 
-        void on_data(char *buf, size_t& size)
+		// makes room for n more framing bytes, a line outgrowing parm::max_line is dropped
+		void make_room(stream& st, size_t n)
 		{
-            if (_parm.type == POS_TYPE_RECEIPTS)
-				on_data_cashing(buf, size);
-            else if (_parm.type == POS_TYPE_TERMINAL)
-				on_data_terminal(buf, size);
-            else if (_parm.type == POS_TYPE_PLAINTEXT)
-                on_data_plaintext(buf, size);
+			st._in._max = std::max(_parm.max_line, c_max_line);
+			if (st._in.reserve(n))
+				return;
+			printf("[pos_net] max_line_size\n");
+			ingest_counters::add(_metrics->overflows);
+			st._in.clear();
+			st._has_started = false;
+			st._scan.reset();
+			st._in.reserve(n);
 		}
 
-		void on_data_terminal(char *buf, size_t& size)
+		// raw bytes go straight to the framing buffer unless they need converting first
+		boost::asio::mutable_buffers_1 read_buffer(stream& st)
 		{
-			std::string msg = parse_terminal_msg(buf, size);
-			if (!msg.empty())
-            {
-                strcpy(buf, msg.c_str());
-                convert_encoding(buf, size);
-                invoke_callback(CALLBACK_TYPE_ITEM, buf);
-            }
-            size = 0;
+			if (st._cvt.active())
+				return boost::asio::buffer(st._raw);
+			make_room(st, c_max_line);
+			return boost::asio::buffer(st._in.tail(), st._in.tail_size());
+		}
+
+        void on_data(stream& st, size_t new_size)
+		{
+			if (st._framing != _framing)
+			{
+				// a read set up before set_framing, its bytes go through the new framing
+				const char *p = st._cvt.active() ? &st._raw[0] : st._in.tail();
+				_refresh_buf.assign(p, p + new_size);
+				refresh_stream(st);
+				on_data(st, &_refresh_buf[0], new_size);
+				return;
+			}
+			if (st._cvt.active())
+			{
+				on_data(st, &st._raw[0], new_size);
+				return;
+			}
+			st._bytes += new_size;
+			ingest_counters::add(_metrics->bytes, new_size);
+			capture(st, st._in.tail(), new_size);
+			st._in.commit(new_size);
+			on_frame(st);
+		}
+
+		// bytes received outside read_buffer(st), e.g. a recvmmsg slot
+		void on_data(stream& st, const char *p, size_t n)
+		{
+			st._bytes += n;
+			ingest_counters::add(_metrics->bytes, n);
+			capture(st, p, n);
+			make_room(st, st._cvt.active() ? encoding_converter::max_output(n) : n);
+			unsigned long invalid = st._cvt.invalid();
+			st._in.commit(st._cvt.convert(p, n, st._in.tail()));
+			if (st._cvt.invalid() != invalid)
+				ingest_counters::add(_metrics->encoding_errors, st._cvt.invalid() - invalid);
+			on_frame(st);
+		}
+
+		void capture(stream& st, const char *p, size_t n)
+		{
+			if (!_capture)
+				return;
+			if (!st._capture_id)
+				st._capture_id = _capture->new_stream();
+			_capture->write(st._capture_id, p, n);
+		}
+
+		void on_frame(stream& st)
+		{
+			refresh_stream(st);
+			bool timed = has_timeouts();
+			if (timed)
+				st._rx_tick = st._wheel->now();
+			char *buf = st._in.data();
+			size_t size = st._in.size();
+			if (_frame)
+				(this->*_frame)(st, buf, size);
+			flush_batch();
+			if (size)
+				st._in.consume(st._in.size() - size);
+			else
+				st._in.clear();
+			if (timed)
+				arm_timer(st);
+		}
+
+		void flush_batch()
+		{
+			_terminal_frames = 0;
+			if (_batch.empty())
+				return;
+			// items still point into st._in, _recs, _msgs or m_cvt_buf
+			unsigned long long t = monotonic_us();
+			_parm.batch_callback(&_batch[0], _batch.size(), _parm.user_parm);
+			_metrics->add_latency(monotonic_us() - t);
+			_batch.clear();
+		}
+
+		bool has_timeouts() const
+		{
+			return _parm.transaction_timeout_ms || (_parm.idle_timeout_ms && _parm.proto == PROTO_TCP);
+		}
+
+		// the wheel entry of st only moves when its next timeout comes sooner, a later one is found when it fires
+		void arm_timer(stream& st)
+		{
+			unsigned long long due = ~0ULL;
+			if (_parm.idle_timeout_ms && _parm.proto == PROTO_TCP)
+				due = st._rx_tick + timer_wheel::ticks(_parm.idle_timeout_ms);
+			if (_parm.transaction_timeout_ms && st._has_started)
+				due = std::min(due, st._start_tick + timer_wheel::ticks(_parm.transaction_timeout_ms));
+			if (due != ~0ULL && (!st._timer.linked() || due < st._timer._due))
+				st._wheel->schedule(&st._timer, due);
+		}
+
+		// the wheel entry of st is due, true when st has gone idle and its owner should close it
+		bool on_stream_timer(stream& st)
+		{
+			unsigned long long now = st._wheel->now();
+			if (_parm.transaction_timeout_ms && st._has_started && now >= st._start_tick + timer_wheel::ticks(_parm.transaction_timeout_ms))
+				time_out_transaction(st);
+			if (_parm.idle_timeout_ms && _parm.proto == PROTO_TCP && now >= st._rx_tick + timer_wheel::ticks(_parm.idle_timeout_ms))
+			{
+				ingest_counters::add(_metrics->idle_closed);
+				return true;
+			}
+			arm_timer(st);
+			return false;
+		}
+
+		// the register went quiet mid-receipt, a pending partial line goes out as its last item; st._in
+		// is left alone as a read may be in flight into it, the next read hunts past what is left
+		void time_out_transaction(stream& st)
+		{
+			printf("[pos_net] transaction timeout on port %d\n", _parm.port);
+			ingest_counters::add(_metrics->timed_out);
+			if (!_parm.item_sep.empty() && st._in.size())
+				invoke_callback(st, CALLBACK_TYPE_ITEM, st._in.data());
+			invoke_callback(st, CALLBACK_TYPE_STOP, c_truncated);
+			flush_batch();
+			st._has_started = false;
+			st._scan.reset();
+		}
+
+		void on_wheel(timer_wheel::entry *e)
+		{
+			on_timer(*(stream *)e->_data);
+		}
+
+		// a stream of this server is due, the framer may be a route
+		virtual void on_timer(stream& st)
+		{
+			on_stream_timer(st);
+		}
+
+		virtual void get_session_stats(std::vector<session_stats>& stats) = 0;
+
+		// bytes skipped to find the next frame or tag
+		void resync(stream& st)
+		{
+			++st._resyncs;
+			ingest_counters::add(_metrics->resyncs);
+		}
+
+		// DPOS frames, a tcp or com read may end mid-frame or hold a backlog of them, a udp datagram
+		// holds whole ones; garbage is hunted past to the next "DPOS$", size is the partial frame to keep
+		void on_data_terminal(stream& st, char *buf, size_t& size)
+		{
+			while (size)
+			{
+				size_t n = find_terminal_frame(buf, size);
+				if (n)
+				{
+					resync(st);
+					buf += n;
+					size -= n;
+					continue;
+				}
+				n = terminal_frame_size(buf, size);
+				if (n == c_terminal_bad_frame)
+				{
+					resync(st);
+					++buf;
+					--size;
+					continue;
+				}
+				if (!n)
+					break;
+				++st._frames;
+				decode_terminal(st, buf, n);
+				buf += n;
+				size -= n;
+			}
+			if (size && _parm.proto == PROTO_UDP)
+			{
+				resync(st);
+				size = 0;
+			}
 		}
 
-		void on_data_cashing(char *buf, size_t& size)
+		void decode_terminal(stream& st, char *frame, size_t n)
 		{
-            convert_encoding(buf, size);
-			char *p = buf;
-			on_data_loop(p, size);
-			if (p == buf)
+			// _batch may still point at the records of earlier frames of this read
+			if (_terminal_frames == _recs.size())
+			{
+				_recs.resize(_terminal_frames + 1);
+				_msgs.resize(_terminal_frames + 1);
+			}
+			terminal_record& rec = _recs[_terminal_frames];
+			if (!parse_terminal_msg(frame, n, rec, _key) || !convert_record(rec))
+			{
+				resync(st);
 				return;
+			}
+			if (_parm.terminal_records && _parm.batch_callback)
+				invoke_callback(st, CALLBACK_TYPE_ITEM, NULL, &rec);
+			else
+			{
+				std::string& msg = _msgs[_terminal_frames];
+				msg = terminal_record_json(rec);
+				invoke_callback(st, CALLBACK_TYPE_ITEM, msg.c_str());
+			}
+			++_terminal_frames;
+		}
 
-			memmove(buf, p, size + 1);
+		// the fields of rec in the encoding of the server, false when one outgrows its buffer
+		bool convert_record(terminal_record& rec)
+		{
+			if (!_msg_cvt.active())
+				return true;
+			for (size_t i=0; i<c_terminal_field_count; ++i)
+			{
+				const terminal_field& f = c_terminal_fields[i];
+				// with its NUL, so a lead byte left at the end becomes '?' rather than being carried
+				char *p = f.of(rec);
+				size_t n = strlen(p) + 1;
+				m_cvt_buf.resize(encoding_converter::max_output(n));
+				n = _msg_cvt.convert(p, n, &m_cvt_buf[0]);
+				_msg_cvt.reset();
+				if (n > f.size)
+				{
+					printf("[pos_net] terminal %s too long[%d/%d] in %s\n", f.name, (int)n - 1, (int)f.size - 1, _parm.encoding.c_str());
+					return false;
+				}
+				memcpy(p, &m_cvt_buf[0], n);
+			}
+			return true;
 		}
 
-        void on_data_plaintext(char *buf, size_t &size)
+        void on_data_plaintext(stream& st, char *buf, size_t &size)
         {
             remove_extra_space(buf, size);
-            convert_encoding(buf, size);
             if (size > 0)
-                invoke_callback(CALLBACK_TYPE_ITEM, buf);
+                invoke_callback(st, CALLBACK_TYPE_ITEM, buf);
 
             size = 0;
         }
 
-		void on_data_loop(char *& buf, size_t& size)
+		// receipts, with item_sep (line by line up to a stop_tag line) or without (all up to the stop_tag is one
+		// item); instantiated for both so the scan loop has no framing branch, size is what is left to keep
+		template <bool ItemSep>
+		void on_data_receipts(stream& st, char *buf, size_t& size)
 		{
 			while (size)
 			{
-				if (!_has_started)
+				if (!st._has_started)
 				{
-					if (size < _parm.start_tag.size())
-						return;
-					BOOST_AUTO(r, boost::find_first(buf, _parm.start_tag));
-					if (r.begin() == r.end())
+					size_t n = _tags.find(tag_matcher::TAG_START, buf, size, st._scan);
+					if (n == tag_matcher::npos)
 					{
-						size = _parm.start_tag.size()-1;
-						buf = r.begin() - size;
+						// only a partial start tag at the end is worth keeping
+						size_t keep = st._scan.matched;
+						if (size > keep)
+							resync(st);
+						buf += size - keep;
+						size = keep;
+						st._scan.scanned = keep;
 						return;
 					}
-					invoke_callback(CALLBACK_TYPE_START);
-					_has_started = true;
-					size = buf + size - r.end();
-					buf = r.end();
+					st._scan.reset();
+					invoke_callback(st, CALLBACK_TYPE_START);
+					st._has_started = true;
+					st._start_tick = st._rx_tick;
+					size -= n;
+					buf += n;
 					continue;
 				}
-				if (_parm.item_sep.empty())
+				if (!ItemSep)
 				{
-					BOOST_AUTO(r, boost::find_first(buf, _parm.stop_tag));
-					if (r.begin() == r.end())
+					size_t n = _tags.find(tag_matcher::TAG_STOP, buf, size, st._scan);
+					st._scan.reset();
+					if (n == tag_matcher::npos)
 					{
-						invoke_callback(CALLBACK_TYPE_ITEM, buf);
+						invoke_callback(st, CALLBACK_TYPE_ITEM, buf);
+						buf += size;
 						size = 0;
-						buf = r.end();
 						return;
 					}
-					if (r.begin() != buf)
+					char *r = buf + n - _parm.stop_tag.size();
+					if (r != buf)
 					{
-						*r.begin() = '\0';
-						invoke_callback(CALLBACK_TYPE_ITEM, buf);
+						*r = '\0';
+						invoke_callback(st, CALLBACK_TYPE_ITEM, buf);
 					}
-					invoke_callback(CALLBACK_TYPE_STOP);
-					_has_started = false;
-					size = buf + size - r.end();
-					buf = r.end();
+					invoke_callback(st, CALLBACK_TYPE_STOP);
+					st._has_started = false;
+					size -= n;
+					buf += n;
 					continue;
 				}
-				if (size < _parm.item_sep.size())
-					return;
-				BOOST_AUTO(r, boost::find_first(buf, _parm.item_sep));
-				if (r.begin() == r.end())
+				size_t n = _tags.find(tag_matcher::TAG_ITEM_SEP, buf, size, st._scan);
+				if (n == tag_matcher::npos)
 					return;
-				if (r.begin() != buf)
+				st._scan.reset();
+				char *r = buf + n - _parm.item_sep.size();
+				if (r != buf)
 				{
-					*r.begin() = '\0';
+					*r = '\0';
 					if (_parm.stop_tag == buf)
 					{
-						invoke_callback(CALLBACK_TYPE_STOP);
-						_has_started = false;
+						invoke_callback(st, CALLBACK_TYPE_STOP);
+						st._has_started = false;
 					}
 					else
-						invoke_callback(CALLBACK_TYPE_ITEM, buf);
+						invoke_callback(st, CALLBACK_TYPE_ITEM, buf);
 				}
-				size = buf + size - r.end();
-				buf = r.end();		
+				size -= n;
+				buf += n;
 			}
 		}
 
@@ -190,61 +740,100 @@ namespace pos_net
             size = ps - txt;
         }
 
-        void convert_encoding(char *&buf, size_t &size)
-        {
-            if (m_cd == libiconv_t(-1))
-                return;
-
-            char *pi = buf;
-            char *po = m_cvt_buf;
-            size_t in_left = size, out_left = sizeof(m_cvt_buf);
-            if (libiconv(m_cd, &pi, &in_left, &po, &out_left) == 0)
-            {
-                buf = m_cvt_buf;
-                size = sizeof(m_cvt_buf) - out_left;
-                buf[size] = '\0';
-            }
-        }
-
 		virtual void start() = 0;
 		virtual void stop() = 0;
 
-        virtual ~server_base()
-        {
-            if (m_cd != libiconv_t(-1))
-            {
-                libiconv_close(m_cd);
-                m_cd = libiconv_t(-1);
-            }
-        }
+		virtual void add_route(unsigned long long key, route *r)
+		{
+			_routes.add(key, r);
+		}
+
+		virtual void remove_route(route *r)
+		{
+			_routes.remove(r);
+		}
+
+        virtual ~server_base() {}
+
+        encoding_converter _msg_cvt;
+        std::vector<char> m_cvt_buf;
+		std::deque<terminal_record> _recs;	// terminal frames of the current read, kept from read to read
+		std::deque<std::string> _msgs;		// _recs as json
+		size_t _terminal_frames;			// of _recs in use until flush_batch
+		std::vector<item_view> _batch;	// events of the current read for parm::batch_callback
+		std::vector<char> _refresh_buf;
+	};
+
+	// a device on a shared port, frames what the listener routes to it on the listener's shard
+	struct route : server_base
+	{
+		server_base *_listener;
+		unsigned long long _key;
+		stream _stream;			// udp, tcp sessions are owned by the listener
+		udp::endpoint _peer;	// last udp sender
+
+		route(const parm& p, server_base *listener, unsigned long long key)
+			: server_base(p, listener->_shard),
+			_listener(listener),
+			_key(key)
+		{
+			_stream._wheel = &_wheel;
+			init_stream(_stream);
+		}
+
+		virtual void start()
+		{
+			_listener->add_route(_key, this);
+		}
+
+		virtual void stop()
+		{
+			_listener->remove_route(this);
+			_wheel.stop();
+			service::async_delete(this, _shard);
+		}
 
-        char m_cvt_buf[c_max_line + 1];
-        libiconv_t m_cd;
+		virtual void get_session_stats(std::vector<session_stats>& stats);
 	};
 
 	struct tcp_server : server_base
 	{
-		struct session 
+		struct session : stream
+#ifdef POS_NET_URING
+			, uring_receiver
+#endif
 		{
 			tcp::socket _socket;
 			bool _dead;
-			char _buf[c_max_line + 1];
-			size_t _recv_len;
 			tcp_server *_server;
+			server_base *_framer;	// _server itself or the route of _peer
+			tcp::endpoint _peer;
+#ifdef POS_NET_URING
+			int _uring_op;			// multishot receive, -1 = none
+#endif
 
 			session(tcp_server *s)
-				: _socket(service::get_io_service()),
+				: _socket(service::get_io_service(s->_shard)),
 				_dead(false),
-				_recv_len(0),
-				_server(s)
+				_server(s),
+				_framer(s)
+#ifdef POS_NET_URING
+				, _uring_op(-1)
+#endif
 			{
-
+				_wheel = &s->_wheel;
+				s->init_stream(*this);
 			}
 
 			void start()
 			{
+#ifdef POS_NET_URING
+				// armed once, it goes on receiving until stop or the peer closes
+				if (_server->_uring && (_uring_op = _server->_uring->recv(_socket.native_handle(), this, false)) >= 0)
+					return;
+#endif
 				_socket.async_read_some(
-					boost::asio::buffer(_buf+_recv_len, c_max_line-_recv_len),
+					_framer->read_buffer(*this),
 					boost::bind(&session::on_recv, this, _1, _2)
 					);
 			}
@@ -259,48 +848,104 @@ namespace pos_net
 					return;
 				}
 				else if (size == 0)
-					start();
-
-				_recv_len += size;
-				_buf[_recv_len] = '\0';
-				_server->on_data(_buf, _recv_len);
-				if (_recv_len == c_max_line)
 				{
-					printf("[pos_net] max_line_size\n");
-					stop();
-				}
-				else
 					start();
+					return;
+				}
+
+				_framer->on_data(*this, size);
+				start();
+			}
+
+#ifdef POS_NET_URING
+			virtual void on_uring_recv(const char *p, size_t n, const sockaddr_in *, bool)
+			{
+				if (!_dead)
+					_framer->on_data(*this, p, n);
+			}
+
+			virtual void on_uring_end(int)
+			{
+				_uring_op = -1;
+				stop();
 			}
+#endif
 
 			void stop()
 			{
 				if (!_dead)
 				{
 					_dead = true;
-					_socket.close();
-					_server->_session = NULL;
-					service::async_delete(this);
+#ifdef POS_NET_URING
+					if (_uring_op >= 0)
+					{
+						_server->_uring->cancel(_uring_op);
+						_uring_op = -1;
+					}
+#endif
+					boost::system::error_code ec;
+					_socket.close(ec);
+					_wheel->cancel(&_timer);
+					_server->remove_session(this);
 				}
 			}
 		};
 
 		tcp::acceptor _acceptor;
-		session *_session;
+		std::vector<session *> _sessions;	// active, oldest first
+		std::vector<session *> _pool;		// closed sessions kept for reuse
 		bool _dead;
+#ifdef POS_NET_URING
+		uring *_uring;
+#endif
 		
-		tcp_server(const parm& p)
-			: server_base(p), 
-			_acceptor(service::get_io_service(), tcp::endpoint(tcp::v4(), p.port)),
-			_session(NULL),
+		tcp_server(const parm& p, size_t shard)
+			: server_base(p, shard), 
+			_acceptor(service::get_io_service(shard)),
 			_dead(false)
+#ifdef POS_NET_URING
+			, _uring(open_uring(p, shard))
+#endif
+		{
+			open_shared(_acceptor, tcp::endpoint(tcp::v4(), p.port), p.listeners > 1);
+			_acceptor.listen();
+		}
+
+		~tcp_server()
+		{
+			for (size_t i=0; i<_pool.size(); ++i)
+				delete _pool[i];
+		}
+
+		session *alloc_session()
+		{
+			if (_pool.empty())
+				return new session(this);
+			session *s = _pool.back();
+			_pool.pop_back();
+			s->reset();
+			s->_dead = false;
+			return s;
+		}
+
+		void remove_session(session *s)
 		{
+			BOOST_AUTO(it, std::find(_sessions.begin(), _sessions.end(), s));
+			if (it != _sessions.end())
+				_sessions.erase(it);
+			s->_framer = this;
+			// the aborted read of s is queued before this, so it is idle once pooled
+			service::async_call(boost::bind(&tcp_server::recycle_session, this, s), _shard);
+		}
 
+		void recycle_session(session *s)
+		{
+			_pool.push_back(s);
 		}
 
 		virtual void start()
 		{
-			session *s = new session(this);
+			session *s = alloc_session();
 			_acceptor.async_accept(
 				s->_socket,
 				boost::bind(&tcp_server::on_accept, this, s, _1)
@@ -316,52 +961,282 @@ namespace pos_net
 			}
 			if (e)
 			{
-				delete s;
+				_pool.push_back(s);
 				start();
 				return;
 			}
-			
-			if (_session)
-				_session->stop();
-			_session = s;
-			_session->start();
-			start();
-		}
 
-		virtual void stop()
-		{
-			if (!_dead)
+			boost::system::error_code ec;
+			s->_peer = s->_socket.remote_endpoint(ec);
+			server_base *f = this;
+			if (_shared)
+				f = _routes.find(s->_peer.address(), s->_peer.port());
+			if (!f)
 			{
-				_dead = true;
-				_acceptor.close();
-				if (_session)
-					_session->stop();
-				service::async_delete(this);
+				printf("[pos_net] no device for %s:%d on port %d\n", s->_peer.address().to_string().c_str(), s->_peer.port(), _parm.port);
+				s->_socket.close(ec);
+				_pool.push_back(s);
+				start();
+				return;
 			}
-		}
+			if (s->_framer != f || s->_framing != f->_framing)
+			{
+				s->_framer = f;
+				f->init_stream(*s);
+			}
+			if (f->has_timeouts())
+			{
+				// a register that connects and never sends still times out
+				s->_rx_tick = _wheel.now();
+				f->arm_timer(*s);
+			}
+
+			// a full table drops the oldest session, usually one a reconnecting register left behind
+			size_t count = 0;
+			session *oldest = NULL;
+			for (size_t i=0; i<_sessions.size(); ++i)
+			{
+				if (_sessions[i]->_framer == f && !count++)
+					oldest = _sessions[i];
+			}
+			if (f->_parm.max_sessions && count >= f->_parm.max_sessions)
+				oldest->stop();
+			_sessions.push_back(s);
+			s->start();
+			start();
+		}
+
+		virtual void stop()
+		{
+			if (!_dead)
+			{
+				_dead = true;
+				boost::system::error_code ec;
+				_acceptor.close(ec);
+				while (!_sessions.empty())
+					_sessions.back()->stop();
+				_wheel.stop();
+				service::async_delete(this, _shard);
+			}
+		}
+
+		virtual void on_timer(stream& st)
+		{
+			session *s = static_cast<session *>(&st);
+			if (s->_framer->on_stream_timer(*s))
+				s->stop();
+		}
+
+		virtual void remove_route(route *r)
+		{
+			server_base::remove_route(r);
+			for (size_t i=_sessions.size(); i>0; --i)
+			{
+				if (i <= _sessions.size() && _sessions[i - 1]->_framer == r)
+					_sessions[i - 1]->stop();
+			}
+		}
+
+		virtual void get_session_stats(std::vector<session_stats>& stats)
+		{
+			get_session_stats(stats, this);
+		}
+
+		void get_session_stats(std::vector<session_stats>& stats, const server_base *framer)
+		{
+			for (size_t i=0; i<_sessions.size(); ++i)
+			{
+				session *s = _sessions[i];
+				if (s->_framer != framer)
+					continue;
+				session_stats r;
+				r.peer = s->_peer.address().to_string() + ":" + boost::lexical_cast<std::string>(s->_peer.port());
+				s->get_stats(r);
+				stats.push_back(r);
+			}
+		}
 	};
 
 	struct udp_server : server_base
+#ifdef POS_NET_URING
+		, uring_receiver
+#endif
 	{
 		udp::socket _socket;
 		udp::endpoint _endpoint;
-		char _buf[c_max_line + 1];
-		size_t _recv_len;
+		stream _stream;
 		bool _dead;
+		static const size_t c_slot = 2048;	// receive space per datagram of a batch or a shared port
+		std::vector<char> _slots;
+#ifdef POS_NET_RECVMMSG
+		std::vector<mmsghdr> _msgs;
+		std::vector<iovec> _iovs;
+		std::vector<sockaddr_in> _names;
+		std::vector<char> _ctrl;
+		size_t _ctrl_size;
+#endif
+#ifdef POS_NET_URING
+		uring *_uring;
+		int _uring_op;
+#endif
 
-		udp_server(const parm& p)
-			: server_base(p),
-			_socket(service::get_io_service(), udp::endpoint(udp::v4(), p.port)),
-			_recv_len(0),
+		udp_server(const parm& p, size_t shard)
+			: server_base(p, shard),
+			_socket(service::get_io_service(shard)),
 			_dead(false)
+#ifdef POS_NET_URING
+			, _uring(open_uring(p, shard)),
+			_uring_op(-1)
+#endif
+		{
+			open_shared(_socket, udp::endpoint(udp::v4(), p.port), p.listeners > 1);
+			if (p.rcvbuf > 0)
+			{
+				boost::system::error_code e;
+				_socket.set_option(boost::asio::socket_base::receive_buffer_size(p.rcvbuf), e);
+				if (e)
+					printf("[pos_net] SO_RCVBUF %d failed\n", p.rcvbuf);
+			}
+			_stream._wheel = &_wheel;
+			init_stream(_stream);
+#ifdef POS_NET_RECVMMSG
+			if (p.udp_batch > 1)
+				init_batch(p.udp_batch);
+#endif
+		}
+
+#ifdef POS_NET_RECVMMSG
+		void init_batch(size_t n)
 		{
+			int on = 1;
+			int fd = _socket.native_handle();
+			setsockopt(fd, SOL_SOCKET, SO_TIMESTAMP, &on, sizeof(on));
+			setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on));
 
+			_ctrl_size = CMSG_SPACE(sizeof(timeval)) + CMSG_SPACE(sizeof(uint32_t));
+			_slots.resize(n * c_slot);
+			_msgs.resize(n);
+			_iovs.resize(n);
+			_names.resize(n);
+			_ctrl.resize(n * _ctrl_size);
 		}
 
+		void on_readable(const boost::system::error_code& e)
+		{
+			if (_dead)
+				return;
+			if (!e)
+				recv_batch();
+			start();
+		}
+#endif
+
+		// the framing and stream of a datagram source, false when no device of a shared port takes it
+		bool find_stream(const udp::endpoint& from, server_base *&f, stream *&st)
+		{
+			if (!_shared)
+			{
+				_endpoint = from;
+				f = this;
+				st = &_stream;
+				return true;
+			}
+			route *r = _routes.find(from.address(), from.port());
+			if (!r)
+				return false;
+			r->_peer = from;
+			f = r;
+			st = &r->_stream;
+			return true;
+		}
+
+#ifdef POS_NET_RECVMMSG
+		// one recvmmsg per wakeup keeps a busy port from starving the other servers on the shard
+		void recv_batch()
+		{
+			size_t n = _msgs.size();
+			for (size_t i = 0; i < n; ++i)
+			{
+				_iovs[i].iov_base = &_slots[i * c_slot];
+				_iovs[i].iov_len = c_slot;
+				msghdr& h = _msgs[i].msg_hdr;
+				h.msg_name = &_names[i];
+				h.msg_namelen = sizeof(sockaddr_in);
+				h.msg_iov = &_iovs[i];
+				h.msg_iovlen = 1;
+				h.msg_control = &_ctrl[i * _ctrl_size];
+				h.msg_controllen = _ctrl_size;
+				h.msg_flags = 0;
+				_msgs[i].msg_len = 0;
+			}
+
+			int got = recvmmsg(_socket.native_handle(), &_msgs[0], n, MSG_DONTWAIT, NULL);
+			if (got <= 0)
+				return;
+
+			timeval now;
+			gettimeofday(&now, NULL);
+			for (int i = 0; i < got; ++i)
+			{
+				udp::endpoint from(address_v4(ntohl(_names[i].sin_addr.s_addr)), ntohs(_names[i].sin_port));
+				server_base *f;
+				stream *st;
+				if (!find_stream(from, f, st))
+					continue;
+				msghdr& h = _msgs[i].msg_hdr;
+				for (cmsghdr *c = CMSG_FIRSTHDR(&h); c; c = CMSG_NXTHDR(&h, c))
+				{
+					if (c->cmsg_level != SOL_SOCKET)
+						continue;
+					if (c->cmsg_type == SCM_TIMESTAMP)
+					{
+						timeval ts;
+						memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+						long long us = (now.tv_sec - ts.tv_sec) * 1000000LL + (now.tv_usec - ts.tv_usec);
+						if (us > 0 && (unsigned long long)us > st->_max_rx_delay_us)
+							st->_max_rx_delay_us = (unsigned long)us;
+					}
+					else if (c->cmsg_type == SO_RXQ_OVFL)
+					{
+						uint32_t drops;	// running total of the socket
+						memcpy(&drops, CMSG_DATA(c), sizeof(drops));
+						ingest_counters::add(f->_metrics->udp_drops, (uint32_t)(drops - _stream._drops));
+						_stream._drops = drops;
+					}
+				}
+				if (h.msg_flags & MSG_TRUNC)
+					++st->_truncated;
+				if (_msgs[i].msg_len)
+					f->on_data(*st, &_slots[i * c_slot], _msgs[i].msg_len);
+			}
+		}
+#endif
+
 		virtual void start()
 		{
+#ifdef POS_NET_URING
+			if (_uring && (_uring_op >= 0 || (_uring_op = _uring->recv(_socket.native_handle(), this, true)) >= 0))
+				return;
+#endif
+#ifdef POS_NET_RECVMMSG
+			if (!_msgs.empty())
+			{
+				_socket.async_receive(boost::asio::null_buffers(), boost::bind(&udp_server::on_readable, this, _1));
+				return;
+			}
+#endif
+			if (_shared)
+			{
+				_slots.resize(c_slot);
+				_socket.async_receive_from(
+					boost::asio::buffer(_slots),
+					_endpoint,
+					boost::bind(&udp_server::on_recv, this, _1, _2)
+					);
+				return;
+			}
 			_socket.async_receive_from(
-				boost::asio::buffer(_buf+_recv_len, c_max_line-_recv_len),
+				read_buffer(_stream),
 				_endpoint,
 				boost::bind(&udp_server::on_recv, this, _1, _2)
 				);
@@ -377,51 +1252,585 @@ namespace pos_net
 				return;
 			}
 
-			_recv_len += size;
-			_buf[_recv_len] = '\0';
-			on_data(_buf, _recv_len);
-			if (_recv_len == c_max_line)
+			if (_shared)
 			{
-				printf("[pos_net] max_line_size\n");
-				_recv_len = 0;
+				server_base *f;
+				stream *st;
+				if (find_stream(_endpoint, f, st))
+					f->on_data(*st, &_slots[0], size);
 			}
+			else
+				on_data(_stream, size);
 			start();
 		}
 
+#ifdef POS_NET_URING
+		virtual void on_uring_recv(const char *p, size_t n, const sockaddr_in *from, bool truncated)
+		{
+			if (_dead || !from)
+				return;
+			server_base *f;
+			stream *st;
+			if (!find_stream(udp::endpoint(address_v4(ntohl(from->sin_addr.s_addr)), ntohs(from->sin_port)), f, st))
+				return;
+			if (truncated)
+				++st->_truncated;
+			if (n)
+				f->on_data(*st, p, n);
+		}
+
+		virtual void on_uring_end(int res)
+		{
+			_uring_op = -1;
+			printf("[pos_net] udp port %d io_uring receive ended(%s)\n", _parm.port, strerror(-res));
+			if (!_dead)
+				start();
+		}
+#endif
+
 		virtual void stop()
 		{
 			if (!_dead)
 			{
 				_dead = true;
+#ifdef POS_NET_URING
+				if (_uring_op >= 0)
+				{
+					_uring->cancel(_uring_op);
+					_uring_op = -1;
+				}
+#endif
 				_socket.close();
-				service::async_delete(this);
+				_wheel.stop();
+				service::async_delete(this, _shard);
+			}
+		}
+
+		virtual void get_session_stats(std::vector<session_stats>& stats)
+		{
+			session_stats r;
+			r.peer = _endpoint.address().to_string() + ":" + boost::lexical_cast<std::string>(_endpoint.port());
+			_stream.get_stats(r);
+			stats.push_back(r);
+		}
+	};
+
+	void route::get_session_stats(std::vector<session_stats>& stats)
+	{
+		if (_parm.proto == PROTO_TCP)
+		{
+			static_cast<tcp_server *>(_listener)->get_session_stats(stats, this);
+			return;
+		}
+		session_stats r;
+		if (_parm.proto == PROTO_COM)
+		{
+			r.peer = _parm.device + "#" + boost::lexical_cast<std::string>(_key);
+			_stream.get_stats(r);
+			stats.push_back(r);
+			return;
+		}
+		r.peer = _peer.address().to_string() + ":" + boost::lexical_cast<std::string>(_peer.port());
+		_stream.get_stats(r);
+		r.drops = static_cast<udp_server *>(_listener)->_stream._drops;	// the kernel only counts per socket
+		stats.push_back(r);
+	}
+
+	static bool serial_speed(unsigned int baudrate, speed_t& speed)
+	{
+		switch (baudrate)
+		{
+		case 1200 : speed = B1200; return true;
+		case 2400 : speed = B2400; return true;
+		case 4800 : speed = B4800; return true;
+		case 9600 : speed = B9600; return true;
+		case 19200 : speed = B19200; return true;
+		case 38400 : speed = B38400; return true;
+		case 57600 : speed = B57600; return true;
+		case 115200 : speed = B115200; return true;
+		default : return false;
+		}
+	}
+
+	// raw non-blocking tty, -1 on failure
+	static int open_serial(const parm& p)
+	{
+		if (p.device.empty())
+			return -1;
+		speed_t speed;
+		if (!serial_speed(p.baudrate, speed) || p.data_bits < 5 || p.data_bits > 8)
+		{
+			printf("[pos_net] bad serial parm(%u %u)\n", p.baudrate, p.data_bits);
+			return -1;
+		}
+		int fd = ::open(p.device.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+		if (fd < 0)
+		{
+			printf("[pos_net] open %s failed\n", p.device.c_str());
+			return -1;
+		}
+
+		termios tio;
+		memset(&tio, 0, sizeof(tio));
+		tcgetattr(fd, &tio);
+		cfmakeraw(&tio);
+		cfsetispeed(&tio, speed);
+		cfsetospeed(&tio, speed);
+		static const tcflag_t c_size[] = { CS5, CS6, CS7, CS8 };
+		tio.c_cflag &= ~(CSIZE | CSTOPB | PARENB | PARODD | CRTSCTS);
+		tio.c_cflag |= c_size[p.data_bits - 5] | CLOCAL | CREAD;
+		if (p.stop_bits == 2)
+			tio.c_cflag |= CSTOPB;
+#ifdef CMSPAR
+		tio.c_cflag &= ~CMSPAR;
+		if (p.parity == 'M' || p.parity == 'S')
+			tio.c_cflag |= PARENB | CMSPAR | (p.parity == 'M' ? PARODD : 0);
+#endif
+		if (p.parity == 'O' || p.parity == 'E')
+			tio.c_cflag |= PARENB | (p.parity == 'O' ? PARODD : 0);
+		tio.c_iflag |= (tio.c_cflag & PARENB) ? INPCK : 0;
+		// reads are non-blocking so VMIN/VTIME only shape readiness, each wakeup drains what the tty holds
+		tio.c_cc[VMIN] = 1;
+		tio.c_cc[VTIME] = 0;
+		if (tcsetattr(fd, TCSANOW, &tio) != 0)
+		{
+			printf("[pos_net] tcsetattr %s failed\n", p.device.c_str());
+			::close(fd);
+			return -1;
+		}
+		tcflush(fd, TCIFLUSH);
+		return fd;
+	}
+
+	struct com_server : server_base
+	{
+		enum e_bus_state { BUS_STX, BUS_ADDRESS, BUS_LENGTH, BUS_PAYLOAD };
+		static const char c_stx = 0x02;
+		static const unsigned char c_max_address = 63;
+
+		static const unsigned int c_reopen_ms = 1000;
+
+		boost::asio::posix::stream_descriptor _port;
+		boost::asio::deadline_timer _reopen;	// retries open after a read error closed the tty
+		stream _stream;
+		bool _dead;
+		std::vector<char> _bus_buf;		// read target of a shared bus, payloads go to the routes
+		e_bus_state _bus_state;
+		route *_bus_route;				// device of the current packet, NULL = not on this box
+		size_t _bus_left;
+
+		com_server(const parm& p, size_t shard)
+			: server_base(p, shard),
+			_port(service::get_io_service(shard)),
+			_reopen(service::get_io_service(shard)),
+			_dead(false),
+			_bus_state(BUS_STX),
+			_bus_route(NULL),
+			_bus_left(0)
+		{
+			_stream._wheel = &_wheel;
+			init_stream(_stream);
+		}
+
+		bool open()
+		{
+			int fd = open_serial(_parm);
+			if (fd < 0)
+				return false;
+			_port.assign(fd);
+			return true;
+		}
+
+		virtual void start()
+		{
+			if (_shared)
+			{
+				_bus_buf.resize(c_max_line);
+				_port.async_read_some(
+					boost::asio::buffer(_bus_buf),
+					boost::bind(&com_server::on_recv, this, _1, _2)
+					);
+				return;
+			}
+			_port.async_read_some(
+				read_buffer(_stream),
+				boost::bind(&com_server::on_recv, this, _1, _2)
+				);
+		}
+
+		void on_recv(const boost::system::error_code& e, size_t size)
+		{
+			if (_dead)
+				return;
+			if (e)
+			{
+				printf("[pos_net] %s read error(%s), reopening\n", _parm.device.c_str(), e.message().c_str());
+				on_port_error();
+				return;
+			}
+
+			if (_shared)
+				on_bus_data(&_bus_buf[0], size);
+			else if (size)
+				on_data(_stream, size);
+			start();
+		}
+
+		// the tty went away (unplugged adapter, hangup), it is closed and reopened every c_reopen_ms
+		void on_port_error()
+		{
+			if (_shared)
+			{
+				for (route_table::map_type::const_iterator it = _routes._map.begin(); it != _routes._map.end(); ++it)
+					ingest_counters::add(it->second->_metrics->port_errors);
+			}
+			else
+				ingest_counters::add(_metrics->port_errors);
+			boost::system::error_code ec;
+			_port.close(ec);
+			schedule_reopen();
+		}
+
+		void schedule_reopen()
+		{
+			_reopen.expires_from_now(boost::posix_time::milliseconds(c_reopen_ms));
+			_reopen.async_wait(boost::bind(&com_server::on_reopen, this, _1));
+		}
+
+		// bytes before the error are not trusted, a half packet or receipt is dropped
+		void on_reopen(const boost::system::error_code& e)
+		{
+			if (_dead || e)
+				return;
+			if (!open())
+			{
+				schedule_reopen();
+				return;
+			}
+			printf("[pos_net] %s reopened\n", _parm.device.c_str());
+			_bus_state = BUS_STX;
+			_bus_route = NULL;
+			_bus_left = 0;
+			_stream._in.clear();
+			_stream._cvt.reset();
+			_stream._has_started = false;
+			_stream._scan.reset();
+			start();
+		}
+
+		// resumable packet scan, payload runs are framed in place by the addressed route
+		void on_bus_data(const char *p, size_t n)
+		{
+			const char *end = p + n;
+			while (p < end)
+			{
+				switch (_bus_state)
+				{
+				case BUS_STX :
+					p = (const char *)memchr(p, c_stx, end - p);
+					if (!p)
+						return;
+					++p;
+					_bus_state = BUS_ADDRESS;
+					break;
+				case BUS_ADDRESS :
+					if (*p == 0 || (unsigned char)*p > c_max_address)
+					{
+						_bus_state = BUS_STX;	// not a packet start, rescan from this byte
+						break;
+					}
+					_bus_route = _routes.find((unsigned char)*p++);
+					_bus_state = BUS_LENGTH;
+					break;
+				case BUS_LENGTH :
+					_bus_left = (unsigned char)*p++;
+					_bus_state = _bus_left ? BUS_PAYLOAD : BUS_STX;
+					break;
+				case BUS_PAYLOAD :
+					{
+						size_t k = std::min(_bus_left, (size_t)(end - p));
+						if (_bus_route)
+							_bus_route->on_data(_bus_route->_stream, p, k);
+						p += k;
+						_bus_left -= k;
+						if (!_bus_left)
+							_bus_state = BUS_STX;
+					}
+					break;
+				}
+			}
+		}
+
+		virtual void remove_route(route *r)
+		{
+			server_base::remove_route(r);
+			if (_bus_route == r)
+				_bus_route = NULL;
+		}
+
+		virtual void stop()
+		{
+			if (!_dead)
+			{
+				_dead = true;
+				boost::system::error_code ec;
+				_port.close(ec);
+				_reopen.cancel(ec);
+				_wheel.stop();
+				service::async_delete(this, _shard);
+			}
+		}
+
+		virtual void get_session_stats(std::vector<session_stats>& stats)
+		{
+			session_stats r;
+			r.peer = _parm.device;
+			_stream.get_stats(r);
+			stats.push_back(r);
+		}
+	};
+
+	// io_service of an offline_framer, a base so it is built before server_base takes it
+	struct framer_io
+	{
+		boost::asio::io_service _io;
+	};
+
+	// a server fed by the caller, see open_framer; nothing runs _io, so no shard is started
+	struct offline_framer : framer_io, server_base
+	{
+		explicit offline_framer(const parm& p) : server_base(untimed(p), _io)
+		{
+			_stream._wheel = &_wheel;
+			init_stream(_stream);
+		}
+
+		// nothing runs the wheel
+		static parm untimed(parm p)
+		{
+			p.transaction_timeout_ms = 0;
+			p.idle_timeout_ms = 0;
+			return p;
+		}
+
+		virtual void start() {}
+		virtual void stop() {}
+
+		virtual void get_session_stats(std::vector<session_stats>& stats)
+		{
+			session_stats r;
+			_stream.get_stats(r);
+			stats.push_back(r);
+		}
+
+		stream _stream;
+	};
+
+	// one or more independent servers sharing a port, each pinned to its own shard
+	struct server_group
+	{
+		std::vector<server_base *> _servers;
+		route *_route;	// device of a shared port, _servers holds just it
+		ingest_counters _metrics;	// outlives _dispatcher
+		std::auto_ptr<event_dispatcher> _dispatcher;
+		std::auto_ptr<capture_writer> _capture;
+
+		server_group() : _route(NULL) {}
+
+		void init_metrics()
+		{
+			for (size_t i=0; i<_servers.size(); ++i)
+				_servers[i]->_metrics = &_metrics;
+		}
+
+		void init_capture(const parm& p)
+		{
+			if (p.capture_path.empty())
+				return;
+			_capture.reset(new capture_writer);
+			if (!_capture->open(p.capture_path))
+			{
+				_capture.reset();
+				return;
 			}
+			for (size_t i=0; i<_servers.size(); ++i)
+				_servers[i]->_capture = _capture.get();
+		}
+
+		// queue the callbacks of every server, before they start
+		void init_dispatch(const parm& p)
+		{
+			if (!p.queue_depth)
+				return;
+			_dispatcher.reset(new event_dispatcher(p.callback, p.batch_callback, p.user_parm, &_metrics));
+			for (size_t i=0; i<_servers.size(); ++i)
+				_servers[i]->_queue = _dispatcher->add_queue(p.queue_depth, p.overflow);
+			_dispatcher->start();
 		}
 	};
 
+	// listeners of ports shared through parm::source_ip, keyed by (proto, port)
+	struct shared_port
+	{
+		server_base *_listener;
+		std::set<unsigned long long> _sources;
+
+		shared_port() : _listener(NULL) {}
+	};
+
+	typedef std::map<std::pair<int, std::string>, shared_port> shared_port_map;
+	static shared_port_map s_shared_ports;
+	static ho::mutex s_shared_mutex;
+
+	void config(const config_parm& p)
+	{
+		service::set_shard_count(p.io_threads);
+	}
+
+	static server_base *create_server(const parm& p, size_t shard)
+	{
+		switch (p.proto)
+		{
+		case PROTO_TCP :
+			return new tcp_server(p, shard);
+		case PROTO_UDP :
+			return new udp_server(p, shard);
+		case PROTO_COM :
+			{
+				std::auto_ptr<com_server> s(new com_server(p, shard));
+				return s->open() ? s.release() : NULL;
+			}
+		default :
+			return NULL;
+		}
+	}
+
+	// a tcp/udp port or a tty
+	static shared_port_map::key_type shared_key(const parm& p)
+	{
+		if (p.proto == PROTO_COM)
+			return shared_port_map::key_type(p.proto, p.device);
+		return shared_port_map::key_type(p.proto, boost::lexical_cast<std::string>(p.port));
+	}
+
+	static void *start_route(const parm& p)
+	{
+		unsigned long long key = p.bus_address;
+		if (p.proto != PROTO_COM)
+		{
+			boost::system::error_code ec;
+			address_v4 ip = address_v4::from_string(p.source_ip, ec);
+			if (ec)
+			{
+				printf("[pos_net] bad source_ip(%s)\n", p.source_ip.c_str());
+				return NULL;
+			}
+			key = route_table::key(ip.to_ulong(), p.source_port);
+		}
+
+		ho::lock_guard lock(s_shared_mutex);
+		shared_port_map::key_type port = shared_key(p);
+		shared_port& sp = s_shared_ports[port];
+		if (sp._sources.count(key))
+		{
+			if (p.proto == PROTO_COM)
+				printf("[pos_net] address %d already on %s\n", p.bus_address, port.second.c_str());
+			else
+				printf("[pos_net] source %s:%d already on port %s\n", p.source_ip.c_str(), p.source_port, port.second.c_str());
+			return NULL;
+		}
+		bool created = false;
+		if (!sp._listener)
+		{
+			size_t shard = p.shard < 0 ? service::next_shard() : (size_t)p.shard % service::shard_count();
+			try
+			{
+				sp._listener = create_server(p, shard);
+			}
+			catch (const std::exception& e)
+			{
+				printf("[pos_net] start error(%s)\n", e.what());
+			}
+			if (!sp._listener)
+			{
+				s_shared_ports.erase(port);
+				return NULL;
+			}
+			sp._listener->_shared = true;
+			created = true;
+		}
+
+		server_group *ret = new server_group;
+		ret->_route = new route(p, sp._listener, key);
+		ret->_servers.push_back(ret->_route);
+		ret->init_metrics();
+		ret->init_capture(p);
+		ret->init_dispatch(p);
+		sp._sources.insert(key);
+		service::async_call(boost::bind(&server_base::start, ret->_route), ret->_route->_shard);
+		if (created)
+			service::async_call(boost::bind(&server_base::start, sp._listener), sp._listener->_shard);
+		return ret;
+	}
+
+	// drops the shared listener with its last device; both leave the table under s_shared_mutex and
+	// are stopped after it is released, so starts and stops of other ports do not wait on a shard
+	static void stop_route(route *r)
+	{
+		server_base *listener = NULL;
+		{
+			ho::lock_guard lock(s_shared_mutex);
+			shared_port_map::iterator it = s_shared_ports.find(shared_key(r->_parm));
+			if (it != s_shared_ports.end())
+			{
+				it->second._sources.erase(r->_key);
+				if (it->second._sources.empty())
+				{
+					listener = it->second._listener;
+					s_shared_ports.erase(it);
+				}
+			}
+		}
+		service::sync_call(boost::bind(&server_base::stop, r), r->_shard);
+		if (listener)
+			service::sync_call(boost::bind(&server_base::stop, listener), listener->_shard);
+	}
+
 	void *start(const parm& p)
 	{
-		server_base *ret;
+		if (p.proto == PROTO_COM ? p.bus_address != 0 : !p.source_ip.empty())
+			return start_route(p);
+
+		server_group *ret = new server_group;
+		size_t shard = p.shard < 0 ? service::next_shard() : (size_t)p.shard % service::shard_count();
+		unsigned int listeners = p.listeners && p.proto != PROTO_COM ? p.listeners : 1;
 		try
 		{
-			switch (p.proto)
+			for (unsigned int i=0; i<listeners; ++i)
 			{
-			case PROTO_TCP :
-				ret = new tcp_server(p);
-				break;
-			case PROTO_UDP :
-				ret = new udp_server(p);
-				break;
-			default :
-				return NULL;
+				server_base *s = create_server(p, (shard + i) % service::shard_count());
+				if (!s)
+					break;
+				ret->_servers.push_back(s);
 			}
 		}
 		catch (const std::exception& e)
 		{
 			printf("[pos_net] start error(%s)\n", e.what());
+			for (size_t i=0; i<ret->_servers.size(); ++i)
+				delete ret->_servers[i];
+			ret->_servers.clear();
+		}
+		if (ret->_servers.empty())
+		{
+			delete ret;
 			return NULL;
 		}
-		service::async_call(boost::bind(&server_base::start, ret));
+		ret->init_metrics();
+		ret->init_capture(p);
+		ret->init_dispatch(p);
+		for (size_t i=0; i<ret->_servers.size(); ++i)
+			service::async_call(boost::bind(&server_base::start, ret->_servers[i]), ret->_servers[i]->_shard);
 		return ret;
 	}
 
@@ -429,8 +1838,117 @@ namespace pos_net
 	{
 		if (p && *p)
 		{
-			service::sync_call(boost::bind(&server_base::stop, (server_base *)(*p)));
+			server_group *g = (server_group *)(*p);
+			if (g->_route)
+				stop_route(g->_route);
+			else
+			{
+				for (size_t i=0; i<g->_servers.size(); ++i)
+					service::sync_call(boost::bind(&server_base::stop, g->_servers[i]), g->_servers[i]->_shard);
+			}
+			delete g;
 			*p = NULL;
 		}
 	}
+
+	static bool same_framing(const parm& a, const parm& b)
+	{
+		return a.type == b.type && a.start_tag == b.start_tag && a.stop_tag == b.stop_tag && a.item_sep == b.item_sep
+			&& a.encoding == b.encoding && a.aes_key == b.aes_key && a.max_line == b.max_line;
+	}
+
+	static bool same_transport(const parm& a, const parm& b)
+	{
+		return a.proto == b.proto && a.port == b.port && a.shard == b.shard && a.listeners == b.listeners
+			&& a.max_sessions == b.max_sessions && a.udp_batch == b.udp_batch && a.rcvbuf == b.rcvbuf
+			&& a.source_ip == b.source_ip && a.source_port == b.source_port
+			&& a.device == b.device && a.baudrate == b.baudrate && a.data_bits == b.data_bits
+			&& a.stop_bits == b.stop_bits && a.parity == b.parity && a.bus_address == b.bus_address
+			&& a.queue_depth == b.queue_depth && a.overflow == b.overflow && a.capture_path == b.capture_path
+			&& a.idle_timeout_ms == b.idle_timeout_ms && a.transaction_timeout_ms == b.transaction_timeout_ms
+			&& a.backend == b.backend && a.terminal_records == b.terminal_records
+			&& a.callback == b.callback && a.batch_callback == b.batch_callback && a.user_parm == b.user_parm;
+	}
+
+	bool reconfigure(void *p, const parm& np)
+	{
+		if (!p)
+			return false;
+		server_group *g = (server_group *)p;
+		// _parm.start_tag carries item_sep
+		parm cur = g->_servers[0]->_parm;
+		cur.start_tag.resize(cur.start_tag.size() - cur.item_sep.size());
+		if (!same_transport(cur, np))
+			return false;
+		if (same_framing(cur, np))
+			return true;
+		for (size_t i=0; i<g->_servers.size(); ++i)
+			service::sync_call(boost::bind(&server_base::set_framing, g->_servers[i], boost::cref(np)), g->_servers[i]->_shard);
+		return true;
+	}
+
+	void get_session_stats(void *p, std::vector<session_stats>& stats)
+	{
+		stats.clear();
+		if (!p)
+			return;
+		server_group *g = (server_group *)p;
+		for (size_t i=0; i<g->_servers.size(); ++i)
+			service::sync_call(boost::bind(&server_base::get_session_stats, g->_servers[i], boost::ref(stats)), g->_servers[i]->_shard);
+	}
+
+	void get_dispatch_stats(void *p, dispatch_stats& stats)
+	{
+		server_group *g = (server_group *)p;
+		if (g && g->_dispatcher.get())
+			g->_dispatcher->get_stats(stats);
+		else
+			memset(&stats, 0, sizeof(stats));
+	}
+
+	void get_ingest_stats(void *p, ingest_stats& stats)
+	{
+		if (p)
+			((server_group *)p)->_metrics.get(stats);
+		else
+			memset(&stats, 0, sizeof(stats));
+	}
+
+	void get_shard_stats(std::vector<shard_stats>& stats)
+	{
+		stats.resize(service::shard_count());
+		for (size_t i=0; i<stats.size(); ++i)
+		{
+			service::shard_stats s = service::get_stats(i);
+			stats[i].queued = s.queued;
+			stats[i].handled = s.handled;
+		}
+	}
+
+	void *open_framer(const parm& p)
+	{
+		return new offline_framer(p);
+	}
+
+	void feed(void *f, const char *data, size_t n)
+	{
+		offline_framer *o = (offline_framer *)f;
+		o->on_data(o->_stream, data, n);
+	}
+
+	void get_framer_stats(void *f, session_stats& session, ingest_stats& totals)
+	{
+		offline_framer *o = (offline_framer *)f;
+		o->_stream.get_stats(session);
+		o->_metrics->get(totals);
+	}
+
+	void close_framer(void **f)
+	{
+		if (f && *f)
+		{
+			delete (offline_framer *)(*f);
+			*f = NULL;
+		}
+	}
 }
@@ -2,15 +2,39 @@
 #define __pos_net_h__
 
 #include <string>
+#include <vector>
 
 namespace pos_net
 {
     enum e_pos_type { POS_TYPE_RECEIPTS, POS_TYPE_TERMINAL, POS_TYPE_PLAINTEXT };
 	enum e_proto { PROTO_COM, PROTO_UDP, PROTO_TCP };
 	enum e_callback_type { CALLBACK_TYPE_START, CALLBACK_TYPE_ITEM, CALLBACK_TYPE_STOP };
+	// item of the STOP that ends a transaction cut off by parm::transaction_timeout_ms, a received STOP has none
+	static const char c_truncated[] = "truncated";
+	struct terminal_record;
+	// one framing event, item is NUL terminated (NULL for START and a received STOP) and only valid during the call
+	struct item_view
+	{
+		e_callback_type type;
+		const char *item;
+		size_t size;
+		const terminal_record *record;	// parm::terminal_records, item is NULL then
+	};
+
+	enum e_overflow { OVERFLOW_DROP, OVERFLOW_BLOCK };	// full callback queue : drop the new event / wait for the consumer
+	enum e_backend { BACKEND_REACTOR, BACKEND_URING };	// receive path of tcp sessions and udp sockets
+
+	struct config_parm
+	{
+		size_t io_threads;	// io_service shards, takes effect before the first start()
+	};
+
+	void config(const config_parm& p);
 
 	struct parm
 	{
+		parm() : type(POS_TYPE_RECEIPTS), proto(PROTO_TCP), port(0), shard(-1), listeners(1), max_sessions(8), max_line(64 * 1024), udp_batch(16), rcvbuf(0), source_port(0), baudrate(9600), data_bits(8), stop_bits(1), parity('N'), bus_address(0), queue_depth(0), overflow(OVERFLOW_DROP), idle_timeout_ms(0), transaction_timeout_ms(0), backend(BACKEND_REACTOR), callback(NULL), batch_callback(NULL), terminal_records(false), user_parm(NULL) {}
+
 		e_pos_type type;
 		e_proto proto;
 		unsigned short port;
@@ -18,13 +42,120 @@ namespace pos_net
 		std::string stop_tag;
 		std::string item_sep;
         std::string encoding;
+		std::string aes_key;	// POS_TYPE_TERMINAL, the 16 byte AES-128 key of the DPOS bodies, empty = the key they ship with
+		int shard;				// io_service shard the server is pinned to, -1 = round-robin
+		unsigned int listeners;	// > 1 : SO_REUSEPORT listeners on consecutive shards, callback must be reentrant
+		size_t max_sessions;	// concurrent tcp sessions per listener, the oldest is dropped beyond it, 0 = unlimited
+		size_t max_line;		// cap of the per-stream receive buffer, a longer pending line is dropped
+		unsigned int udp_batch;	// datagrams drained per wakeup with recvmmsg (linux), <= 1 = one receive per datagram
+		int rcvbuf;				// SO_RCVBUF of the udp socket, 0 = system default
+		// set source_ip to share port with other devices, only connections/datagrams from
+		// source_ip:source_port reach this device (source_port 0 = any port, source_ip 0.0.0.0 = any unmatched source)
+		std::string source_ip;
+		unsigned short source_port;
+		// PROTO_COM, device is the tty path, e.g. /dev/ttyAMA1
+		std::string device;
+		unsigned int baudrate;
+		unsigned char data_bits;	// 5 - 8
+		unsigned char stop_bits;	// 1 or 2
+		char parity;				// 'N'one, 'O'dd, 'E'ven, 'M'ark, 'S'pace
+		// 1 - 63 : device on a multi-drop rs-485 bus, the tty is shared with the other addresses and carries
+		// packets of STX(0x02) address length(1 byte) payload, only payloads of this address are framed
+		unsigned char bus_address;
+		size_t queue_depth;		// > 0 : callbacks run on a thread of their own behind a queue of this many events, 0 = on the io thread
+		e_overflow overflow;
+		unsigned int idle_timeout_ms;			// > 0 : a tcp session that sends nothing for this long is closed
+		// > 0 : a transaction whose stop tag has not come this long after its start tag ends with a STOP
+		// of item c_truncated, what it had received stays delivered, the rest of it is hunted past
+		unsigned int transaction_timeout_ms;
+		// BACKEND_URING : multishot io_uring receives into a buffer ring of the shard (linux >= 6.0), no
+		// syscall per read; the reactor is kept where the kernel refuses it, udp_batch and the udp kernel
+		// timestamps / drop counts only apply to the reactor
+		e_backend backend;
+		std::string capture_path;	// non-empty : raw received bytes are recorded to this file for pos_net::replay (pos_capture.h)
 		// POS_TYPE_TERMINAL callback item = {"terminal_code":"1","card_id":"2","money":"99.99","terminal_model":"4","serial":"5","time":"20170417112459"}
 		void (*callback)(e_callback_type type, const char *item, void *user_parm);
+		// set instead of callback to get the events of a read (or of the dispatch queue) in one call
+		void (*batch_callback)(const item_view *items, size_t count, void *user_parm);
+		// POS_TYPE_TERMINAL with batch_callback : an item carries the terminal_record (pos_terminal_parser.h)
+		// the frame was decoded into, no json is made for it
+		bool terminal_records;
 		void *user_parm;
 	};
 
 	void *start(const parm& p);
 	void stop(void **p);
+
+	// swaps type, tags, encoding, aes_key and max_line of a started p on its live sockets, the bytes
+	// already received are framed again with the new tags; false when any other member of np
+	// differs, that needs a stop/start
+	bool reconfigure(void *p, const parm& np);
+
+	struct session_stats
+	{
+		std::string peer;	// ip:port of the tcp client, last sender for udp, tty path for com
+		unsigned long long bytes;
+		unsigned long items;
+		unsigned long transactions;
+		unsigned long drops;			// udp datagrams dropped by the kernel for a full receive queue (SO_RXQ_OVFL)
+		unsigned long truncated;		// udp datagrams cut to the receive slot size
+		unsigned long frames;			// POS_TYPE_TERMINAL frames cut out of the stream, decoded or not
+		unsigned long resyncs;			// times bytes were skipped to find the next frame or start tag
+		unsigned long max_rx_delay_us;	// largest kernel timestamp to delivery delay of a udp datagram
+	};
+
+	void get_session_stats(void *p, std::vector<session_stats>& stats);
+
+	struct dispatch_stats
+	{
+		size_t depth;		// events waiting for the callback
+		size_t high_water;	// deepest queue seen
+		unsigned long long dispatched;
+		unsigned long dropped;	// OVERFLOW_DROP events lost to a full queue
+	};
+
+	// all zero without parm::queue_depth
+	void get_dispatch_stats(void *p, dispatch_stats& stats);
+
+	// device totals since start, counters only grow so rates come from two snapshots
+	struct ingest_stats
+	{
+		static const size_t c_latency_buckets = 20;
+
+		unsigned long long bytes;
+		unsigned long long items;
+		unsigned long long transactions;
+		unsigned long long resyncs;			// pending data dropped while hunting for a start tag, or a bad terminal frame
+		unsigned long long encoding_errors;	// received bytes that did not decode, shown as '?'
+		unsigned long long overflows;		// lines dropped for outgrowing parm::max_line
+		unsigned long long udp_drops;		// datagrams the kernel dropped for a full receive queue
+		unsigned long long timed_out;		// transactions ended by parm::transaction_timeout_ms
+		unsigned long long idle_closed;		// tcp sessions closed by parm::idle_timeout_ms
+		unsigned long long port_errors;		// com read errors, each closes the tty until a reopen succeeds
+		unsigned long long callbacks;		// callback (or batch callback) runs timed below
+		unsigned long long latency_us[c_latency_buckets];	// bucket i counts runs of [2^i, 2^(i+1)) us, 0 also counts < 1 us
+		unsigned long long max_latency_us;
+		unsigned long long uptime_ms;
+	};
+
+	// lock-free, callable from any thread while p is started
+	void get_ingest_stats(void *p, ingest_stats& stats);
+
+	struct shard_stats
+	{
+		long queued;	// handlers posted to the shard and not yet run, pending i/o is not counted
+		long handled;	// handlers run, i/o completions and timers included
+	};
+
+	void get_shard_stats(std::vector<shard_stats>& stats);
+
+	// frames bytes handed in on the calling thread the way a server of p would, without socket or thread, to
+	// check a capture offline or to time and fuzz the framers; p's callback or batch_callback has run by the
+	// time feed returns, queue_depth, capture_path and the timeouts do not apply
+	void *open_framer(const parm& p);
+	void feed(void *f, const char *data, size_t n);	// one read of a tcp or com stream, or one udp datagram
+	void get_framer_stats(void *f, session_stats& session, ingest_stats& totals);
+	void close_framer(void **f);
 }
 
 #endif // __pos_net_h__
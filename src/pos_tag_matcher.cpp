@@ -0,0 +1,68 @@
+#include <string.h>
+#include "pos_tag_matcher.h"
+
+namespace pos_net
+{
+	tag_matcher::tag_matcher(const std::string& start_tag, const std::string& item_sep, const std::string& stop_tag)
+	{
+		_tags[TAG_START] = start_tag;
+		_tags[TAG_ITEM_SEP] = item_sep;
+		_tags[TAG_STOP] = stop_tag;
+
+		for (int t=0; t<TAG_NUM; ++t)
+		{
+			const std::string& s = _tags[t];
+			std::vector<size_t>& f = _fail[t];
+			f.assign(s.size() + 1, 0);
+			for (size_t i=1, k=0; i<s.size(); ++i)
+			{
+				while (k && s[i] != s[k])
+					k = f[k];
+				if (s[i] == s[k])
+					++k;
+				f[i + 1] = k;
+			}
+		}
+	}
+
+	size_t tag_matcher::find(e_tag t, const char *p, size_t n, state& st) const
+	{
+		const std::string& s = _tags[t];
+		const std::vector<size_t>& f = _fail[t];
+		if (s.empty())
+		{
+			st.scanned = n;
+			return npos;
+		}
+
+		size_t i = st.scanned, k = st.matched;
+		while (i < n)
+		{
+			if (!k)
+			{
+				// skip to the next candidate first byte, memchr is vectorized by the libc
+				const char *c = (const char *)memchr(p + i, s[0], n - i);
+				if (!c)
+				{
+					i = n;
+					break;
+				}
+				i = c - p;
+			}
+			while (k && p[i] != s[k])
+				k = f[k];
+			if (p[i] == s[k])
+				++k;
+			++i;
+			if (k == s.size())
+			{
+				st.scanned = i;
+				st.matched = k;
+				return i;
+			}
+		}
+		st.scanned = i;
+		st.matched = k;
+		return npos;
+	}
+}
@@ -0,0 +1,42 @@
+#ifndef __pos_tag_matcher_h__
+#define __pos_tag_matcher_h__
+
+#include <string>
+#include <vector>
+
+namespace pos_net
+{
+	// resumable KMP search for the framing tags of one pos_net::parm, built once per server
+	struct tag_matcher
+	{
+		enum e_tag { TAG_START, TAG_ITEM_SEP, TAG_STOP, TAG_NUM };
+
+		static const size_t npos = (size_t)-1;
+
+		// progress of one search, kept across reads so no byte is scanned twice
+		struct state
+		{
+			size_t scanned;	// bytes of the pending data already examined
+			size_t matched;	// length of the tag prefix ending at scanned
+
+			state() : scanned(0), matched(0) {}
+			void reset() { scanned = matched = 0; }
+		};
+
+		tag_matcher() {}
+		tag_matcher(const std::string& start_tag, const std::string& item_sep, const std::string& stop_tag);
+
+		const std::string& tag(e_tag t) const { return _tags[t]; }
+
+		// continues the search of tag t in p[st.scanned, n), returns the offset just past the
+		// first match or npos when p holds none (st then describes where to resume); an empty
+		// tag never matches
+		size_t find(e_tag t, const char *p, size_t n, state& st) const;
+
+	private:
+		std::string _tags[TAG_NUM];
+		std::vector<size_t> _fail[TAG_NUM];
+	};
+}
+
+#endif // __pos_tag_matcher_h__
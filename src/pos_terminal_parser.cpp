@@ -1,10 +1,22 @@
 
-#include <rapidjson/document.h>
 #include <rapidjson/writer.h>
 #include <rapidjson/stringbuffer.h>
 #include <boost/lexical_cast.hpp>
+#include <algorithm>
 #include "pos_terminal_parser.h"
 
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define POS_AES_NI
+#include <wmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define POS_TARGET_AES
+#else
+#include <cpuid.h>
+#define POS_TARGET_AES __attribute__((target("aes,sse2")))
+#endif
+#endif
+
 namespace pos_net
 {
 	static unsigned char aes_key[] = {0xab,0x1c,0x2b,0xcc,0x3a,0xef,0x7d,0x6a,0x4e,0x9c,0xdb,0x8a,0x3c,0x7b,0xbc,0xff};
@@ -46,9 +58,8 @@ namespace pos_net
 		0xa0,0xe0,0x3b,0x4d,0xae,0x2a,0xf5,0xb0,0xc8,0xeb,0xbb,0x3c,0x83,0x53,0x99,0x61, /*e*/ 
 		0x17,0x2b,0x04,0x7e,0xba,0x77,0xd6,0x26,0xe1,0x69,0x14,0x63,0x55,0x21,0x0c,0x7d  /*f*/
 	}; 
-	static unsigned char s_w[11][4][4];
 
-	static void KeyExpansion(unsigned char* key)
+	static void KeyExpansion(const unsigned char* key, unsigned char w[][4][4])
 	{
 		int i,j,r,c;
 		unsigned char rc[] = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36};
@@ -56,7 +67,7 @@ namespace pos_net
 		{
 			for(c=0; c<4; c++)
 			{
-				s_w[0][r][c] = key[r+c*4];
+				w[0][r][c] = key[r+c*4];
 			}
 		}
 		for(i=1; i<=10; i++)
@@ -66,7 +77,7 @@ namespace pos_net
 				unsigned char t[4];
 				for(r=0; r<4; r++)
 				{
-					t[r] = j ? s_w[i][r][j-1] : s_w[i-1][r][3];
+					t[r] = j ? w[i][r][j-1] : w[i-1][r][3];
 				}
 				if(j == 0)
 				{
@@ -80,7 +91,7 @@ namespace pos_net
 				}
 				for(r=0; r<4; r++)
 				{
-					s_w[i][r][j] = s_w[i-1][r][j] ^ t[r];
+					w[i][r][j] = w[i-1][r][j] ^ t[r];
 				}
 			}
 		}
@@ -110,7 +121,7 @@ namespace pos_net
 		return res;
 	}
 
-	static void AddRoundKey(unsigned char state[][4], unsigned char k[][4])
+	static void AddRoundKey(unsigned char state[][4], const unsigned char k[][4])
 	{
 		int r,c;
 		for(c=0; c<4; c++)
@@ -171,7 +182,92 @@ namespace pos_net
 		}
 	}
 
-	static unsigned char* InvCipher_t(unsigned char* input)
+	static void SubBytes(unsigned char state[][4])
+	{
+		int r,c;
+		for(r=0; r<4; r++)
+		{
+			for(c=0; c<4; c++)
+			{
+				state[r][c] = Sbox[state[r][c]];
+			}
+		}
+	}
+
+	static void ShiftRows(unsigned char state[][4])
+	{
+		unsigned char t[4];
+		int r,c;
+		for(r=1; r<4; r++)
+		{
+			for(c=0; c<4; c++)
+			{
+				t[c] = state[r][(c+r)%4];
+			}
+			for(c=0; c<4; c++)
+			{
+				state[r][c] = t[c];
+			}
+		}
+	}
+
+	static void MixColumns(unsigned char state[][4])
+	{
+		unsigned char t[4];
+		int r,c;
+		for(c=0; c< 4; c++)
+		{
+			for(r=0; r<4; r++)
+			{
+				t[r] = state[r][c];
+			}
+			for(r=0; r<4; r++)
+			{
+				state[r][c] = FFmul(0x02, t[r])
+					^ FFmul(0x03, t[(r+1)%4])
+					^ FFmul(0x01, t[(r+2)%4])
+					^ FFmul(0x01, t[(r+3)%4]);
+			}
+		}
+	}
+
+	static unsigned char* Cipher_t(unsigned char* input, const unsigned char w[][4][4])
+	{
+		unsigned char state[4][4];
+		int i,r,c;
+
+		for(r=0; r<4; r++)
+		{
+			for(c=0; c<4 ;c++)
+			{
+				state[r][c] = input[c*4+r];
+			}
+		}
+
+		AddRoundKey(state, w[0]);
+		for(i=1; i<=10; i++)
+		{
+			SubBytes(state);
+			ShiftRows(state);
+			if(i != 10)
+			{
+				MixColumns(state);
+			}
+			AddRoundKey(state, w[i]);
+		}
+
+		for(r=0; r<4; r++)
+		{
+			for(c=0; c<4 ;c++)
+			{
+				input[c*4+r] = state[r][c];
+			}
+		}
+
+		return input;
+	}
+
+	static unsigned char* InvCipher_t(unsigned char* input, const unsigned char w[][4][4])
 	{
 		unsigned char state[4][4];
 		int i,r,c;
@@ -184,12 +280,12 @@ namespace pos_net
 			}
 		}
 
-		AddRoundKey(state, s_w[10]);
+		AddRoundKey(state, w[10]);
 		for(i=9; i>=0; i--)
 		{
 			InvShiftRows(state);
 			InvSubBytes(state);
-			AddRoundKey(state, s_w[i]);
+			AddRoundKey(state, w[i]);
 			if(i)
 			{
 				InvMixColumns(state);
@@ -207,35 +303,231 @@ namespace pos_net
 		return input;
 	}
 
-	static void* InvCipher(void* input, int length)
+	static void* InvCipher(void* input, int length, const unsigned char w[][4][4])
+	{
+		unsigned char* in = (unsigned char*) input;
+		int i;
+		for(i=0; i<length; i+=16)
+		{
+			InvCipher_t(in+i, w);
+		}
+		return input;
+	}
+
+	// InvSubBytes then InvMixColumns of a byte at row r, its output column packed row 0 in the low byte
+	static unsigned int s_td[4][256];
+
+	static void init_dec_tables()
+	{
+		for (int x=0; x<256; x++)
+		{
+			unsigned char s = InvSbox[x];
+			unsigned int w = FFmul(0x0e, s) | FFmul(0x09, s) << 8 | FFmul(0x0d, s) << 16 | (unsigned int)FFmul(0x0b, s) << 24;
+			for (int r=0; r<4; r++)
+				s_td[r][x] = r ? w << 8*r | w >> (32 - 8*r) : w;
+		}
+	}
+
+	terminal_key::terminal_key()
+	{
+		init(aes_key);
+	}
+
+	terminal_key::terminal_key(const unsigned char key[16])
+	{
+		init(key);
+	}
+
+	// dw is in the block's byte order (byte i at row i%4 column i/4) and has InvMixColumns applied to
+	// rounds 1 to 9, so each round is one table lookup per byte (or one aesdec) with InvShiftRows,
+	// InvSubBytes and InvMixColumns folded together
+	void terminal_key::init(const unsigned char key[16])
+	{
+		KeyExpansion(key, w);
+		for (int i=0; i<=10; i++)
+		{
+			unsigned char k[4][4];
+			memcpy(k, w[i], sizeof(k));
+			if (i && i != 10)
+				InvMixColumns(k);
+			for (int r=0; r<4; r++)
+				for (int c=0; c<4; c++)
+					dw[i][c*4+r] = k[r][c];
+		}
+	}
+
+	static const terminal_key s_builtin_key;
+
+	const terminal_key& terminal_key::builtin()
+	{
+		return s_builtin_key;
+	}
+
+	static inline unsigned int load_column(const unsigned char *p)
+	{
+		return p[0] | p[1] << 8 | p[2] << 16 | (unsigned int)p[3] << 24;
+	}
+
+	// portable engine, 16 lookups and 4 xors of a column word per round instead of the bit loops of FFmul
+	static void InvCipher_table(unsigned char *in, size_t length, const terminal_key& key)
+	{
+		for (size_t b=0; b<length; b+=16, in+=16)
+		{
+			unsigned int s[4], t[4];
+			for (int c=0; c<4; c++)
+				s[c] = load_column(in + c*4) ^ load_column(key.dw[10] + c*4);
+			for (int i=9; i>=1; i--)
+			{
+				// InvShiftRows : row r of column c comes from column c-r
+				for (int c=0; c<4; c++)
+					t[c] = s_td[0][s[c] & 0xff] ^ s_td[1][s[(c+3)&3] >> 8 & 0xff]
+						^ s_td[2][s[(c+2)&3] >> 16 & 0xff] ^ s_td[3][s[(c+1)&3] >> 24]
+						^ load_column(key.dw[i] + c*4);
+				memcpy(s, t, sizeof(s));
+			}
+			for (int c=0; c<4; c++)
+			{
+				in[c*4] = InvSbox[s[c] & 0xff] ^ key.dw[0][c*4];
+				in[c*4+1] = InvSbox[s[(c+3)&3] >> 8 & 0xff] ^ key.dw[0][c*4+1];
+				in[c*4+2] = InvSbox[s[(c+2)&3] >> 16 & 0xff] ^ key.dw[0][c*4+2];
+				in[c*4+3] = InvSbox[s[(c+1)&3] >> 24] ^ key.dw[0][c*4+3];
+			}
+		}
+	}
+
+#ifdef POS_AES_NI
+	static bool has_aes_ni()
+	{
+#ifdef _MSC_VER
+		int r[4];
+		__cpuid(r, 1);
+		return (r[2] & (1 << 25)) != 0;
+#else
+		unsigned int a, b, c, d;
+		return __get_cpuid(1, &a, &b, &c, &d) && (c & bit_AES);
+#endif
+	}
+
+	// dw is already in the aesdec key order, aesimc included
+	POS_TARGET_AES static void InvCipher_aesni(unsigned char *in, size_t length, const terminal_key& key)
+	{
+		__m128i k[11];
+		for (int i=0; i<=10; i++)
+			k[i] = _mm_loadu_si128((const __m128i *)key.dw[i]);
+		for (size_t b=0; b<length; b+=16, in+=16)
+		{
+			__m128i s = _mm_xor_si128(_mm_loadu_si128((const __m128i *)in), k[10]);
+			for (int i=9; i>=1; i--)
+				s = _mm_aesdec_si128(s, k[i]);
+			_mm_storeu_si128((__m128i *)in, _mm_aesdeclast_si128(s, k[0]));
+		}
+	}
+#endif
+
+	static void InvCipher_reference(unsigned char *in, size_t length, const terminal_key& key)
+	{
+		InvCipher(in, (int)length, key.w);
+	}
+
+	typedef void (*inv_cipher_fn)(unsigned char *in, size_t length, const terminal_key& key);
+	static inv_cipher_fn s_inv_cipher = InvCipher_reference;
+	static e_aes_engine s_aes_engine = AES_ENGINE_REFERENCE;
+
+	e_aes_engine get_aes_engine()
+	{
+		return s_aes_engine;
+	}
+
+	bool set_aes_engine(e_aes_engine e)
+	{
+		switch (e)
+		{
+		case AES_ENGINE_REFERENCE:
+			s_inv_cipher = InvCipher_reference;
+			break;
+		case AES_ENGINE_TTABLE:
+			s_inv_cipher = InvCipher_table;
+			break;
+#ifdef POS_AES_NI
+		case AES_ENGINE_AESNI:
+			if (!has_aes_ni())
+				return false;
+			s_inv_cipher = InvCipher_aesni;
+			break;
+#endif
+		default:
+			return false;
+		}
+		s_aes_engine = e;
+		return true;
+	}
+
+	static void* Cipher(void* input, int length, const unsigned char w[][4][4])
 	{
 		unsigned char* in = (unsigned char*) input;
 		int i;
 		for(i=0; i<length; i+=16)
 		{
-			InvCipher_t(in+i);
+			Cipher_t(in+i, w);
 		}
 		return input;
 	}
 
-	void* aes_dec(void *data, unsigned long len)
+	void* aes_enc(void *data, unsigned long len, const terminal_key& key)
 	{
-		return InvCipher(data, len);
+		return Cipher(data, len, key.w);
+	}
+
+	void* aes_dec(void *data, unsigned long len, const terminal_key& key)
+	{
+		s_inv_cipher((unsigned char*)data, len, key);
+		return data;
 	}
 
 	struct auto_init
 	{
 		auto_init()
 		{
-			KeyExpansion(aes_key);
+			init_dec_tables();
+			if (!set_aes_engine(AES_ENGINE_AESNI))
+				set_aes_engine(AES_ENGINE_TTABLE);
 		}
 	};
 	static auto_init s_auto_init;
 
-	std::string parse_terminal_msg(char *msg, size_t len)
+	static const size_t c_body_len = 128;
+
+	// strtok on '$' within [p, end) that keeps its place in p instead of a hidden static and
+	// leaves the bytes alone, the field is [ret, ret + n); a NUL ends the walk as it ends a string
+	static const char *next_field(const char *&p, const char *end, size_t& n)
 	{
-		std::string res;
+		while (p != end && *p == '$')
+			++p;
+		if (p == end || !*p)
+			return NULL;
+		const char *f = p;
+		while (p != end && *p && *p != '$')
+			++p;
+		n = p - f;
+		if (p != end && *p == '$')
+			++p;
+		return f;
+	}
 
+#define POS_TERMINAL_FIELD(f) { #f, offsetof(terminal_record, f), sizeof(((terminal_record *)0)->f) }
+	const terminal_field c_terminal_fields[c_terminal_field_count] =
+	{
+		POS_TERMINAL_FIELD(terminal_code),
+		POS_TERMINAL_FIELD(card_id),
+		POS_TERMINAL_FIELD(money),
+		POS_TERMINAL_FIELD(terminal_model),
+		POS_TERMINAL_FIELD(serial),
+		POS_TERMINAL_FIELD(time)
+	};
+#undef POS_TERMINAL_FIELD
+
+	bool parse_terminal_msg(char *msg, size_t len, terminal_record& rec, const terminal_key& key)
+	{
 		static const int c_header_member_num = 3;
 		char *header_members[c_header_member_num];
 		header_members[0] = msg;
@@ -255,49 +547,111 @@ namespace pos_net
 			++msg;
 		}
 
-		static const size_t c_body_len = 128;
-		if (header_member_num != c_header_member_num || len < c_body_len || strcmp(header_members[0], "DPOS"))
+		// len still counts the '$' in front of the body
+		if (header_member_num != c_header_member_num || len <= c_body_len || strcmp(header_members[0], "DPOS"))
 		{
 			printf("[pos_net] parse_terminal_msg not DPOS msg\n");
-			return res;
+			return false;
 		}
 
-		aes_dec(++msg, c_body_len);
+		aes_dec(++msg, c_body_len, key);
 
-		static const int c_body_member_num = 6;
-		static const char *body_members[c_body_member_num] =
+		// a body that decrypts to garbage must not run on into the bytes after it
+		const char *body = msg;
+		const char *body_end = msg + c_body_len;
+		size_t body_member_num = 0;
+		size_t n = 0;
+		const char *p = next_field(body, body_end, n);
+		while (p)
 		{
-			"terminal_code",
-			"card_id",
-			"money",
-			"terminal_model",
-			"serial",
-			"time"
-		};
+			const terminal_field& f = c_terminal_fields[body_member_num++];
+			if (n >= f.size)
+			{
+				printf("[pos_net] parse_terminal_msg %s too long[%d/%d]\n", f.name, (int)n, (int)f.size - 1);
+				return false;
+			}
+			memcpy(f.of(rec), p, n);
+			f.of(rec)[n] = '\0';
+			if (body_member_num == c_terminal_field_count)
+				break;
+			p = next_field(body, body_end, n);
+		}
 
-		rapidjson::Document doc;
-		doc.SetObject();
+		if (body_member_num != c_terminal_field_count)
+		{
+			printf("[pos_net] parse_terminal_msg body_member_num error[%d/%d]\n", (int)body_member_num, (int)c_terminal_field_count);
+			return false;
+		}
+		return true;
+	}
 
-		static const char *delim="$";
-		int body_member_num = 0;
-		char *p = strtok(msg, delim);
-		while (p)
+	size_t find_terminal_frame(const char *p, size_t n)
+	{
+		static const char c_magic[] = "DPOS$";
+		for (size_t i=0; i<n; ++i)
 		{
-			doc.AddMember(rapidjson::StringRef(body_members[body_member_num++]), rapidjson::StringRef(p), doc.GetAllocator());
-			if (body_member_num == c_body_member_num)
+			const char *d = (const char *)memchr(p + i, 'D', n - i);
+			if (!d)
 				break;
-			p = strtok(NULL, delim);
+			i = d - p;
+			if (!memcmp(d, c_magic, std::min(n - i, sizeof(c_magic) - 1)))
+				return i;
 		}
+		return n;
+	}
 
-		if (body_member_num != c_body_member_num)
+	// the header as parse_terminal_msg splits it, the body is c_body_len whatever its length member says
+	size_t terminal_frame_size(const char *p, size_t n)
+	{
+		int header_member_num = 0;
+		for (size_t i=0; i<n && i<c_terminal_header_max; ++i)
 		{
-			printf("[pos_net] parse_terminal_msg body_member_num error[%d/%d]\n", body_member_num, c_body_member_num);
-			return res;
+			if (!p[i])
+				return c_terminal_bad_frame;
+			if (p[i] == '$' && ++header_member_num == 3)
+				return n - i - 1 >= c_body_len ? i + 1 + c_body_len : 0;
 		}
+		return n < c_terminal_header_max ? 0 : c_terminal_bad_frame;
+	}
 
+	std::string terminal_record_json(const terminal_record& rec)
+	{
 		rapidjson::StringBuffer sb;
 		rapidjson::Writer<rapidjson::StringBuffer> w(sb);
-		doc.Accept(w);
+		w.StartObject();
+		for (size_t i=0; i<c_terminal_field_count; ++i)
+		{
+			w.String(c_terminal_fields[i].name);
+			w.String(c_terminal_fields[i].of(rec));
+		}
+		w.EndObject();
 		return sb.GetString();
 	}
+
+	std::string parse_terminal_msg(char *msg, size_t len, const terminal_key& key)
+	{
+		terminal_record rec;
+		if (!parse_terminal_msg(msg, len, rec, key))
+			return std::string();
+		return terminal_record_json(rec);
+	}
+
+	std::string make_terminal_msg(const std::string fields[6], const terminal_key& key)
+	{
+		std::string body;
+		for (int i=0; i<6; ++i)
+		{
+			if (i)
+				body += '$';
+			body += fields[i];
+		}
+		if (body.size() >= c_body_len)
+		{
+			printf("[pos_net] make_terminal_msg body too long[%d]\n", (int)body.size());
+			return std::string();
+		}
+		body.resize(c_body_len, '\0');
+		aes_enc(&body[0], c_body_len, key);
+		return "DPOS$1$" + boost::lexical_cast<std::string>(c_body_len) + "$" + body;
+	}
 }
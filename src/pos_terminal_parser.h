@@ -2,10 +2,81 @@
 #define __pos_terminal_parser_h__
 
 #include <string>
+#include <cstddef>
 
 namespace pos_net
 {
-	std::string parse_terminal_msg(char *msg, size_t len);
+	// expanded AES-128 key of the DPOS bodies of a terminal vendor, never changed once built so any
+	// number of threads may parse with it at once
+	struct terminal_key
+	{
+		terminal_key();		// the key the terminals ship with
+		explicit terminal_key(const unsigned char key[16]);
+		static const terminal_key& builtin();
+
+		unsigned char w[11][4][4];	// encryption round keys, [round][row][column]
+		unsigned char dw[11][16];	// decryption round keys of the equivalent inverse cipher
+
+	private:
+		void init(const unsigned char key[16]);
+	};
+
+	// the six fields of a DPOS body, NUL terminated in buffers of the column sizes the records are kept to
+	struct terminal_record
+	{
+		char terminal_code[9];
+		char card_id[21];
+		char money[16];
+		char terminal_model[17];
+		char serial[9];
+		char time[16];			// yyyymmddhhmmss
+	};
+
+	// a field of terminal_record, name is its json key and t_record_terminal column
+	struct terminal_field
+	{
+		const char *name;
+		size_t offset;
+		size_t size;			// with the NUL
+
+		char *of(terminal_record& rec) const { return (char *)&rec + offset; }
+		const char *of(const terminal_record& rec) const { return (const char *)&rec + offset; }
+	};
+
+	static const size_t c_terminal_field_count = 6;
+	extern const terminal_field c_terminal_fields[c_terminal_field_count];	// in DPOS body order
+
+	// reentrant, msg is split and its body decrypted in place; false for anything but a DPOS
+	// frame whose six fields fit rec
+	bool parse_terminal_msg(char *msg, size_t len, terminal_record& rec, const terminal_key& key = terminal_key::builtin());
+	// {"terminal_code":"1","card_id":"2","money":"99.99","terminal_model":"4","serial":"5","time":"20170417112459"}
+	std::string terminal_record_json(const terminal_record& rec);
+	// the record as terminal_record_json, empty when the parse fails
+	std::string parse_terminal_msg(char *msg, size_t len, const terminal_key& key = terminal_key::builtin());
+
+	// a byte stream of DPOS frames, each "DPOS$version$length$" and a 128 byte body, is cut with these:
+	// the offset in p[0,n) of the first "DPOS$", or of a part of it left at the end, n when there is none
+	size_t find_terminal_frame(const char *p, size_t n);
+	// size of the frame p[0,n) starts with (p from find_terminal_frame), 0 when more bytes are needed,
+	// c_terminal_bad_frame when its header runs into a NUL or past c_terminal_header_max
+	static const size_t c_terminal_header_max = 32;
+	static const size_t c_terminal_bad_frame = (size_t)-1;
+	size_t terminal_frame_size(const char *p, size_t n);
+
+	// engines of the DPOS body decryption, the fastest the cpu has is picked at startup; the
+	// reference is the original byte by byte cipher the others are checked against
+	enum e_aes_engine { AES_ENGINE_REFERENCE, AES_ENGINE_TTABLE, AES_ENGINE_AESNI };
+	e_aes_engine get_aes_engine();
+	// process wide, for startup and tests; false, and the engine is kept, when this cpu lacks e
+	bool set_aes_engine(e_aes_engine e);
+
+	// in place, len a multiple of 16
+	void* aes_enc(void *data, unsigned long len, const terminal_key& key = terminal_key::builtin());
+	void* aes_dec(void *data, unsigned long len, const terminal_key& key = terminal_key::builtin());
+
+	// DPOS frame of terminal_code, card_id, money, terminal_model, serial, time as parse_terminal_msg
+	// expects it, the fields must not contain '$', empty when they outgrow the 128 byte body
+	std::string make_terminal_msg(const std::string fields[6], const terminal_key& key = terminal_key::builtin());
 }
 
 #endif // __pos_terminal_parser_h__
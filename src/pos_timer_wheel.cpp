@@ -0,0 +1,107 @@
+#include "pos_timer_wheel.h"
+#include "pos_metrics.h"
+#include <boost/bind.hpp>
+#include <algorithm>
+
+namespace pos_net
+{
+	timer_wheel::timer_wheel(boost::asio::io_service& io, const handler& h)
+		: _timer(io), _handler(h), _origin_us(monotonic_us()), _tick(0), _count(0), _running(false), _dead(false)
+	{
+	}
+
+	void timer_wheel::link(entry *head, entry *e)
+	{
+		e->_prev = head->_prev;
+		e->_next = head;
+		head->_prev->_next = e;
+		head->_prev = e;
+		++_count;
+	}
+
+	void timer_wheel::unlink(entry *e)
+	{
+		e->_prev->_next = e->_next;
+		e->_next->_prev = e->_prev;
+		e->_prev = e->_next = e;
+		--_count;
+	}
+
+	unsigned long long timer_wheel::now() const
+	{
+		return (monotonic_us() - _origin_us) / (c_tick_ms * 1000);
+	}
+
+	void timer_wheel::schedule(entry *e, unsigned long long due)
+	{
+		if (_dead)
+			return;
+		if (e->linked())
+			unlink(e);
+		if (!_running)
+		{
+			// the ticks missed while idle had nothing to fire
+			_tick = now();
+			start_timer();
+		}
+		e->_due = std::max(due, _tick + 1);
+		link(&_slots[e->_due % c_slots], e);
+	}
+
+	void timer_wheel::cancel(entry *e)
+	{
+		if (e->linked())
+			unlink(e);
+	}
+
+	void timer_wheel::stop()
+	{
+		_dead = true;
+		boost::system::error_code ec;
+		_timer.cancel(ec);
+	}
+
+	void timer_wheel::start_timer()
+	{
+		_running = true;
+		_timer.expires_from_now(boost::posix_time::milliseconds((long)c_tick_ms));
+		_timer.async_wait(boost::bind(&timer_wheel::on_tick, this, _1));
+	}
+
+	void timer_wheel::on_tick(const boost::system::error_code& e)
+	{
+		if (e || _dead)
+			return;
+		// a late wakeup walks every slot it skipped, at most one turn
+		unsigned long long t = now();
+		unsigned long long from = _tick;
+		size_t n = (size_t)std::min(t - from, (unsigned long long)c_slots);
+		_tick = t;
+		for (size_t i = 1; i <= n; ++i)
+		{
+			entry *head = &_slots[(from + i) % c_slots];
+			if (!head->linked())
+				continue;
+			// detached first, the handler may schedule into this very slot or cancel any entry
+			entry due;
+			due._next = head->_next;
+			due._prev = head->_prev;
+			due._next->_prev = &due;
+			due._prev->_next = &due;
+			head->_prev = head->_next = head;
+			while (due.linked())
+			{
+				entry *x = due._next;
+				unlink(x);
+				if (x->_due <= t)
+					_handler(x);
+				else
+					link(head, x);
+			}
+		}
+		if (_count)
+			start_timer();
+		else
+			_running = false;
+	}
+}
@@ -0,0 +1,58 @@
+#ifndef __pos_timer_wheel_h__
+#define __pos_timer_wheel_h__
+
+#include "net_driver.h"
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/function.hpp>
+
+namespace pos_net
+{
+	// hashed timing wheel of one server, schedule and cancel are O(1) list splices and the
+	// server runs a single asio timer that only ticks while entries are linked; deadlines
+	// are in ticks of c_tick_ms and an entry fires up to one tick late
+	struct timer_wheel : boost::noncopyable
+	{
+		static const unsigned int c_tick_ms = 100;
+		static const size_t c_slots = 512;	// one turn, later deadlines sit out whole turns in their slot
+
+		struct entry
+		{
+			entry *_prev;
+			entry *_next;
+			unsigned long long _due;	// tick
+			void *_data;
+
+			explicit entry(void *data = NULL) : _prev(this), _next(this), _due(0), _data(data) {}
+			bool linked() const { return _next != this; }
+		};
+
+		typedef boost::function<void (entry *)> handler;
+
+		// h runs on the thread of io for each entry whose tick has come, unlinked
+		timer_wheel(boost::asio::io_service& io, const handler& h);
+
+		unsigned long long now() const;		// ticks since construction, off the monotonic clock
+		static unsigned long long ticks(unsigned int ms) { return (ms + c_tick_ms - 1) / c_tick_ms; }
+
+		void schedule(entry *e, unsigned long long due);	// a linked e is moved
+		void cancel(entry *e);
+		void stop();	// before the owner goes, nothing fires after it
+
+	private:
+		void on_tick(const boost::system::error_code& e);
+		void start_timer();
+		void link(entry *head, entry *e);
+		void unlink(entry *e);
+
+		boost::asio::deadline_timer _timer;
+		handler _handler;
+		entry _slots[c_slots];
+		unsigned long long _origin_us;
+		unsigned long long _tick;	// last tick fired
+		size_t _count;				// linked entries
+		bool _running;
+		bool _dead;
+	};
+}
+
+#endif // __pos_timer_wheel_h__
@@ -0,0 +1,439 @@
+#include "pos_uring.h"
+
+#ifdef POS_NET_URING
+#include <boost/bind.hpp>
+#include <algorithm>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+namespace pos_net
+{
+	static const unsigned long long c_cancel_data = ~0ULL;	// user_data of the cancel ops themselves
+
+	static unsigned long long op_data(int index, unsigned int gen)
+	{
+		return ((unsigned long long)gen << 32) | (unsigned int)index;
+	}
+
+	static int uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags)
+	{
+		return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+	}
+
+	boost::asio::io_service::id uring::id;
+
+	uring *uring::instance(boost::asio::io_service& io)
+	{
+		uring& u = boost::asio::use_service<uring>(io);
+		return u._ready ? &u : NULL;
+	}
+
+	uring::uring(boost::asio::io_service& io)
+		: boost::asio::io_service::service(io),
+		_io(io), _fd(-1), _event_fd(-1), _event(io), _sq_ring(MAP_FAILED), _sq_ring_size(0), _cq_ring(MAP_FAILED), _cq_ring_size(0),
+		_sqes((io_uring_sqe *)MAP_FAILED), _sqes_size(0), _buf_ring((io_uring_buf *)MAP_FAILED), _buf_ring_size(0),
+		_buf_tail(0), _free(-1), _live(0), _waiting(false), _ready(false), _deferred(false), _enabled(false)
+	{
+		_ready = init();
+	}
+
+#if BOOST_VERSION >= 106600
+	void uring::shutdown()
+#else
+	void uring::shutdown_service()
+#endif
+	{
+		_ready = false;
+	}
+
+	uring::~uring()
+	{
+		if (_buf_ring != MAP_FAILED)
+			munmap(_buf_ring, _buf_ring_size);
+		if (_sqes != MAP_FAILED)
+			munmap(_sqes, _sqes_size);
+		if (_cq_ring != MAP_FAILED && _cq_ring != _sq_ring)
+			munmap(_cq_ring, _cq_ring_size);
+		if (_sq_ring != MAP_FAILED)
+			munmap(_sq_ring, _sq_ring_size);
+		if (_fd >= 0)
+			close(_fd);
+		if (_event_fd >= 0 && !_event.is_open())
+			close(_event_fd);
+	}
+
+	bool uring::init()
+	{
+		io_uring_params p;
+		memset(&p, 0, sizeof(p));
+		// multishot receives complete far more often than they are submitted; completions wait for
+		// the shard to reap them rather than interrupting it (6.1), the ring is enabled on the shard
+		// thread as only that one may submit to it
+		p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP | IORING_SETUP_R_DISABLED | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+		p.cq_entries = c_buffers * 4;
+		_fd = (int)syscall(__NR_io_uring_setup, c_entries, &p);
+		_deferred = _fd >= 0;
+		if (_fd < 0 && errno == EINVAL)
+		{
+			memset(&p, 0, sizeof(p));
+			p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP;
+			p.cq_entries = c_buffers * 4;
+			_fd = (int)syscall(__NR_io_uring_setup, c_entries, &p);
+			_enabled = true;
+		}
+		if (_fd < 0)
+		{
+			printf("[pos_net] io_uring_setup failed(%s)\n", strerror(errno));
+			return false;
+		}
+
+		_sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+		_cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+		if (p.features & IORING_FEAT_SINGLE_MMAP)
+			_sq_ring_size = _cq_ring_size = std::max(_sq_ring_size, _cq_ring_size);
+		_sq_ring = mmap(NULL, _sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+		if (_sq_ring == MAP_FAILED)
+			return false;
+		if (p.features & IORING_FEAT_SINGLE_MMAP)
+			_cq_ring = _sq_ring;
+		else
+		{
+			_cq_ring = mmap(NULL, _cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+			if (_cq_ring == MAP_FAILED)
+				return false;
+		}
+		_sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+		_sqes = (io_uring_sqe *)mmap(NULL, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+		if (_sqes == MAP_FAILED)
+			return false;
+
+		char *sq = (char *)_sq_ring;
+		_sq_head = (unsigned int *)(sq + p.sq_off.head);
+		_sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+		_sq_mask = *(unsigned int *)(sq + p.sq_off.ring_mask);
+		_sq_array = (unsigned int *)(sq + p.sq_off.array);
+		_sq_flags = (unsigned int *)(sq + p.sq_off.flags);
+		char *cq = (char *)_cq_ring;
+		_cq_head = (unsigned int *)(cq + p.cq_off.head);
+		_cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+		_cq_mask = *(unsigned int *)(cq + p.cq_off.ring_mask);
+		_cqes = (io_uring_cqe *)(cq + p.cq_off.cqes);
+
+		// buffer group 0, the kernel takes a buffer per completion and gets it back once framed
+		_buf_ring_size = c_buffers * sizeof(io_uring_buf);
+		_buf_ring = (io_uring_buf *)mmap(NULL, _buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (_buf_ring == MAP_FAILED)
+			return false;
+		io_uring_buf_reg reg;
+		memset(&reg, 0, sizeof(reg));
+		reg.ring_addr = (unsigned long long)(size_t)_buf_ring;
+		reg.ring_entries = c_buffers;
+		reg.bgid = 0;
+		if (syscall(__NR_io_uring_register, _fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+		{
+			printf("[pos_net] io_uring buffer ring failed(%s)\n", strerror(errno));
+			return false;
+		}
+		_buffers.resize(c_buffers * c_buffer_size);
+		for (unsigned int i = 0; i < c_buffers; ++i)
+			release_buffer((unsigned short)i);
+
+		_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (_event_fd < 0 || syscall(__NR_io_uring_register, _fd, IORING_REGISTER_EVENTFD, &_event_fd, 1) < 0)
+		{
+			printf("[pos_net] io_uring eventfd failed(%s)\n", strerror(errno));
+			return false;
+		}
+		boost::system::error_code ec;
+		_event.assign(_event_fd, ec);
+		return !ec;
+	}
+
+	io_uring_sqe *uring::get_sqe()
+	{
+		unsigned int tail = *_sq_tail;
+		unsigned int pending = tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE);
+		// entries a failed io_uring_enter left in the queue are handed over again first
+		if (pending > _sq_mask && uring_enter(_fd, pending, 0, 0) < 0)
+			printf("[pos_net] io_uring_enter failed(%s)\n", strerror(errno));
+		if (tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE) > _sq_mask)
+			return NULL;
+		io_uring_sqe *sqe = &_sqes[tail & _sq_mask];
+		memset(sqe, 0, sizeof(*sqe));
+		return sqe;
+	}
+
+	// ops are rare next to completions, each goes in right away
+	void uring::submit()
+	{
+		unsigned int tail = *_sq_tail;
+		_sq_array[tail & _sq_mask] = tail & _sq_mask;
+		__atomic_store_n(_sq_tail, tail + 1, __ATOMIC_RELEASE);
+		if (uring_enter(_fd, 1, 0, 0) < 0)
+			printf("[pos_net] io_uring_enter failed(%s)\n", strerror(errno));
+	}
+
+	int uring::recv(int fd, uring_receiver *r, bool datagram)
+	{
+		if (!_enabled)
+		{
+			if (syscall(__NR_io_uring_register, _fd, IORING_REGISTER_ENABLE_RINGS, NULL, 0) < 0)
+			{
+				printf("[pos_net] io_uring enable failed(%s)\n", strerror(errno));
+				return -1;
+			}
+			_enabled = true;
+		}
+		int index = _free;
+		if (index >= 0)
+			_free = _ops[index].next_free;
+		else
+		{
+			index = (int)_ops.size();
+			_ops.push_back(op());
+			_ops.back().gen = 0;
+		}
+		++_live;
+		if (!_waiting)
+			wait();
+		op& o = _ops[index];
+		o.receiver = r;
+		o.fd = fd;
+		o.datagram = datagram;
+		o.armed = false;
+		o.dry = false;
+		++o.gen;
+		if (!arm(index))
+		{
+			free_op(index);
+			return -1;
+		}
+		return index;
+	}
+
+	bool uring::arm(int index)
+	{
+		op& o = _ops[index];
+		io_uring_sqe *sqe = get_sqe();
+		if (!sqe)
+			return false;
+		if (o.datagram)
+		{
+			// each datagram lands as io_uring_recvmsg_out, the sender, then the payload
+			memset(&o.msg, 0, sizeof(o.msg));
+			o.msg.msg_namelen = sizeof(sockaddr_in);
+			sqe->opcode = IORING_OP_RECVMSG;
+			sqe->addr = (unsigned long long)(size_t)&o.msg;
+			sqe->len = 1;
+		}
+		else
+			sqe->opcode = IORING_OP_RECV;
+		sqe->fd = o.fd;
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = 0;
+		sqe->user_data = op_data(index, o.gen);
+		o.armed = true;
+		submit();
+		return true;
+	}
+
+	void uring::cancel(int index)
+	{
+		if (index < 0 || (size_t)index >= _ops.size())
+			return;
+		op& o = _ops[index];
+		o.receiver = NULL;
+		if (o.dry && !o.armed)
+			return;		// freed by rearm_dry
+		if (!o.armed)
+		{
+			free_op(index);
+			return;
+		}
+		// the op is freed by its last completion, until then the kernel holds the socket
+		if (submit_cancel(index))
+			return;
+		// tried again right after this handler and then after each reap, the queue frees up as
+		// the kernel takes its entries
+		if (_cancels.empty())
+			_io.post(boost::bind(&uring::retry_cancels, this));
+		_cancels.push_back(op_data(index, o.gen));
+	}
+
+	bool uring::submit_cancel(int index)
+	{
+		io_uring_sqe *sqe = get_sqe();
+		if (!sqe)
+			return false;
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->addr = op_data(index, _ops[index].gen);
+		sqe->user_data = c_cancel_data;
+		submit();
+		return true;
+	}
+
+	void uring::retry_cancels()
+	{
+		if (!_ready)
+			return;
+		std::vector<unsigned long long> cancels;
+		cancels.swap(_cancels);
+		for (size_t i = 0; i < cancels.size(); ++i)
+		{
+			int index = (int)(cancels[i] & 0xffffffff);
+			const op& o = _ops[index];
+			// ended by itself meanwhile, and maybe reused
+			if (o.gen != (unsigned int)(cancels[i] >> 32) || !o.armed || o.receiver)
+				continue;
+			if (!submit_cancel(index))
+				_cancels.push_back(cancels[i]);
+		}
+	}
+
+	void uring::free_op(int index)
+	{
+		_ops[index].receiver = NULL;
+		_ops[index].armed = false;
+		_ops[index].next_free = _free;
+		_free = index;
+		--_live;
+	}
+
+	void uring::release_buffer(unsigned short bid)
+	{
+		io_uring_buf& b = _buf_ring[_buf_tail & (c_buffers - 1)];
+		b.addr = (unsigned long long)(size_t)&_buffers[bid * c_buffer_size];
+		b.len = c_buffer_size;
+		b.bid = bid;
+		++_buf_tail;
+		// the ring tail overlays resv of the first entry
+		__atomic_store_n(&_buf_ring[0].resv, _buf_tail, __ATOMIC_RELEASE);
+	}
+
+	void uring::wait()
+	{
+		_waiting = true;
+		_event.async_read_some(boost::asio::null_buffers(), boost::bind(&uring::on_event, this, _1));
+	}
+
+	void uring::on_event(const boost::system::error_code& e)
+	{
+		_waiting = false;
+		if (e || !_ready)
+			return;
+		unsigned long long count;
+		if (::read(_event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+			printf("[pos_net] io_uring eventfd read failed(%s)\n", strerror(errno));
+		if (_deferred)
+			uring_enter(_fd, 0, 0, IORING_ENTER_GETEVENTS);
+		for (;;)
+		{
+			unsigned int head = *_cq_head;
+			unsigned int tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+			if (head == tail)
+			{
+				// completions that did not fit the queue wait in the kernel
+				if (!(__atomic_load_n(_sq_flags, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW))
+					break;
+				uring_enter(_fd, 0, 0, IORING_ENTER_GETEVENTS);
+				if (__atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE) == head)
+					break;
+				continue;
+			}
+			for (; head != tail; ++head)
+			{
+				const io_uring_cqe& c = _cqes[head & _cq_mask];
+				unsigned long long user_data = c.user_data;
+				int res = c.res;
+				unsigned int flags = c.flags;
+				// the slot goes back first, a receiver may arm or cancel from on_cqe
+				__atomic_store_n(_cq_head, head + 1, __ATOMIC_RELEASE);
+				on_cqe(user_data, res, flags);
+			}
+		}
+		retry_cancels();
+		rearm_dry();
+		if (_live)
+			wait();
+	}
+
+	void uring::on_cqe(unsigned long long user_data, int res, unsigned int flags)
+	{
+		if (user_data == c_cancel_data)
+			return;
+		int index = (int)(user_data & 0xffffffff);
+		if ((size_t)index >= _ops.size() || _ops[index].gen != (unsigned int)(user_data >> 32))
+			return;
+		op& o = _ops[index];
+		if (flags & IORING_CQE_F_BUFFER)
+		{
+			unsigned short bid = (unsigned short)(flags >> IORING_CQE_BUFFER_SHIFT);
+			const char *p = &_buffers[bid * c_buffer_size];
+			if (res > 0)
+				o.dry = false;
+			if (res > 0 && o.receiver)
+			{
+				if (!o.datagram)
+					o.receiver->on_uring_recv(p, res, NULL, false);
+				else if ((size_t)res >= sizeof(io_uring_recvmsg_out) + o.msg.msg_namelen)
+				{
+					const io_uring_recvmsg_out *out = (const io_uring_recvmsg_out *)p;
+					const char *name = p + sizeof(io_uring_recvmsg_out);
+					const char *payload = name + o.msg.msg_namelen + o.msg.msg_controllen;
+					size_t n = std::min((size_t)out->payloadlen, (size_t)(p + res - payload));
+					const sockaddr_in *from = out->namelen >= sizeof(sockaddr_in) ? (const sockaddr_in *)name : NULL;
+					o.receiver->on_uring_recv(payload, n, from, (out->flags & MSG_TRUNC) != 0);
+				}
+			}
+			release_buffer(bid);
+		}
+		if (flags & IORING_CQE_F_MORE)
+			return;
+
+		// the kernel let go of the op
+		o.armed = false;
+		uring_receiver *r = o.receiver;
+		if (!r)
+		{
+			free_op(index);
+			return;
+		}
+		// a multishot receive also stops for a full completion queue or a dry buffer ring, a second
+		// dry stop right after the queue was drained is an error
+		if (res == -ENOBUFS && !o.dry)
+		{
+			o.dry = true;
+			_dry.push_back(index);
+			return;
+		}
+		if (res > 0 && arm(index))
+			return;
+		free_op(index);
+		r->on_uring_end(res);
+	}
+
+	void uring::rearm_dry()
+	{
+		std::vector<int> dry;
+		dry.swap(_dry);
+		for (size_t i = 0; i < dry.size(); ++i)
+		{
+			op& o = _ops[dry[i]];
+			uring_receiver *r = o.receiver;
+			if (!r)
+				free_op(dry[i]);
+			else if (!arm(dry[i]))
+			{
+				free_op(dry[i]);
+				r->on_uring_end(-ENOBUFS);
+			}
+		}
+	}
+}
+#endif // POS_NET_URING
@@ -0,0 +1,124 @@
+#ifndef __pos_uring_h__
+#define __pos_uring_h__
+
+#include "net_driver.h"
+
+#ifdef __linux__
+#include <linux/version.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 0, 0)
+#define POS_NET_URING
+#endif
+#endif
+
+#ifdef POS_NET_URING
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <boost/version.hpp>
+#include <deque>
+#include <linux/io_uring.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+namespace pos_net
+{
+	// owner of a multishot receive, called on the shard thread of its uring
+	struct uring_receiver
+	{
+		// one read (tcp) or datagram (udp, with its sender), p is only valid during the call
+		virtual void on_uring_recv(const char *p, size_t n, const sockaddr_in *from, bool truncated) = 0;
+		// the receive ended by itself, 0 = peer closed, < 0 = -errno; not called after uring::cancel
+		virtual void on_uring_end(int res) = 0;
+		virtual ~uring_receiver() {}
+	};
+
+	// io_uring of one io_service (a shard), an asio service so it goes with it: multishot receives
+	// fill buffers of a provided buffer ring, so an idle socket holds no buffer and a busy one costs
+	// no syscall per read; completions are reaped when the ring's eventfd wakes the shard's reactor,
+	// which only waits on it while receives are live so the shard can still run out of work
+	struct uring : boost::asio::io_service::service
+	{
+		static const unsigned int c_entries = 256;		// submission queue
+		static const unsigned int c_buffers = 1024;		// provided buffers, a power of 2
+		static const size_t c_buffer_size = 2048;
+
+		static boost::asio::io_service::id id;
+
+		explicit uring(boost::asio::io_service& io);
+		~uring();
+
+		// that of io, set up on first use, NULL when the kernel refuses io_uring or buffer rings
+		static uring *instance(boost::asio::io_service& io);
+
+		// arms a multishot recv (datagram : recvmsg with the sender) of fd, returns the op id or -1
+		int recv(int fd, uring_receiver *r, bool datagram);
+		// r gets nothing more from op once this returns, fd may be closed right after; a cancel
+		// that finds the submission queue full is submitted again once completions are reaped
+		void cancel(int op);
+
+	private:
+		struct op
+		{
+			uring_receiver *receiver;	// NULL once cancelled, its completions are dropped
+			int fd;
+			bool datagram;
+			bool armed;					// the kernel still holds the op
+			bool dry;					// re-armed for a dry buffer ring, nothing received since
+			unsigned int gen;
+			msghdr msg;
+			int next_free;
+		};
+
+#if BOOST_VERSION >= 106600
+		virtual void shutdown();
+#else
+		virtual void shutdown_service();
+#endif
+		bool init();
+		io_uring_sqe *get_sqe();
+		void submit();
+		bool arm(int index);
+		void wait();
+		void on_event(const boost::system::error_code& e);
+		void on_cqe(unsigned long long user_data, int res, unsigned int flags);
+		void rearm_dry();
+		bool submit_cancel(int index);
+		void retry_cancels();
+		void release_buffer(unsigned short bid);
+		void free_op(int index);
+
+		boost::asio::io_service& _io;
+		int _fd;
+		int _event_fd;
+		boost::asio::posix::stream_descriptor _event;
+		void *_sq_ring;
+		size_t _sq_ring_size;
+		void *_cq_ring;
+		size_t _cq_ring_size;
+		io_uring_sqe *_sqes;
+		size_t _sqes_size;
+		unsigned int *_sq_head;
+		unsigned int *_sq_tail;
+		unsigned int _sq_mask;
+		unsigned int *_sq_array;
+		unsigned int *_sq_flags;
+		unsigned int *_cq_head;
+		unsigned int *_cq_tail;
+		unsigned int _cq_mask;
+		io_uring_cqe *_cqes;
+		io_uring_buf *_buf_ring;	// io_uring_buf_ring, whose flexible array sits at offset 8 in c++
+		size_t _buf_ring_size;
+		std::vector<char> _buffers;
+		unsigned short _buf_tail;
+		std::deque<op> _ops;		// msg stays put for the kernel as ops are added
+		int _free;
+		size_t _live;				// ops not free, the eventfd is waited on while there are any
+		bool _waiting;
+		bool _ready;
+		bool _deferred;				// IORING_SETUP_DEFER_TASKRUN, completions are run by io_uring_enter on the shard
+		bool _enabled;
+		std::vector<int> _dry;		// ops stopped by a dry buffer ring, armed again once the reaped buffers are back
+		std::vector<unsigned long long> _cancels;	// op_data of cancels the full submission queue held back
+	};
+}
+#endif // POS_NET_URING
+
+#endif // __pos_uring_h__
@@ -24,23 +24,37 @@ PosDataAnalyzer::PosDataAnalyzer(int PosId, POS::ConfigInfo *pCfgInfo)
 {
 }
 
+/* the record of the open transaction, handed to the db thread on STOP */
+pos_db::arena_record &PosDataAnalyzer::Record()
+{
+    if (!m_record.get())
+        m_record = pos_db::alloc_record();
+    return *m_record;
+}
+
 void PosDataAnalyzer::addItem(pos_net::e_callback_type type, const char *item)
+{
+    addItem(type, item, item ? strlen(item) : 0);
+}
+
+void PosDataAnalyzer::addItem(pos_net::e_callback_type type, const char *item, size_t size)
 {
 	if (pos_net::CALLBACK_TYPE_START == type)
 	{
-		m_record.pos_id = mPosId;
-		m_record.pos_name = m_pPosCfg->Name;
-		GetOsTime(m_record.start);
-		m_record.relate_channels = m_pPosCfg->BoundChns;
-        m_record.items.clear();
+		pos_db::record &head = Record().head;
+		head.pos_id = mPosId;
+		head.pos_name = m_pPosCfg->Name;
+		GetOsTime(head.start);
+		head.relate_channels = m_pPosCfg->BoundChns;
+        m_record->items.clear();
     }
 	else if (pos_net::CALLBACK_TYPE_ITEM == type)
 	{
-		m_record.items.push_back(item);
+		Record().items.add(item, size);
 	}
 	else if (pos_net::CALLBACK_TYPE_STOP == type)
 	{
-		GetOsTime(m_record.stop);
+		GetOsTime(Record().head.stop);
 		pos_db::write(m_record);
     }
 }
@@ -50,14 +64,14 @@ void PosDataAnalyzer::writePlainText(const char *text)
     pos_db::time tm;
     GetOsTime(tm);
 
-    m_record.pos_id = mPosId;
-    m_record.pos_name = m_pPosCfg->Name;
-    m_record.start = tm;
-    m_record.stop = tm;
-    m_record.relate_channels = m_pPosCfg->BoundChns;
-    m_record.items.push_back(text);
+    pos_db::record &head = Record().head;
+    head.pos_id = mPosId;
+    head.pos_name = m_pPosCfg->Name;
+    head.start = tm;
+    head.stop = tm;
+    head.relate_channels = m_pPosCfg->BoundChns;
+    m_record->items.clear();
+    m_record->items.add(text, strlen(text));
     pos_db::write(m_record);
-
-    m_record.items.clear();
 }
 
@@ -23,11 +23,14 @@ class PosDataAnalyzer
 public:
     PosDataAnalyzer(int PosId, POS::ConfigInfo *pCfgInfo);
     void addItem(pos_net::e_callback_type type, const char *item);
+    void addItem(pos_net::e_callback_type type, const char *item, size_t size);
     void writePlainText(const char *text);
 
 private:
+    pos_db::arena_record &Record();
+
     //std::stack<PosDealData> mActiveDeals;
-    pos_db::record m_record;/*Ȳͬʱstart*/
+    std::auto_ptr<pos_db::arena_record> m_record;/*Ȳͬʱstart*/
     POS::ConfigInfo *m_pPosCfg;
     int mPosId;
 };
@@ -19,6 +19,7 @@ namespace POS {
         std::string Stop;
         std::string Separator;
         std::string Encoding;
+        std::string AesKey;          /*终端DPOS报文的AES-128密钥，16字节，空则用出厂密钥*/
         std::vector<unsigned char> BoundChns;
         RS_U8 CommType;
         RS_U8 PosType;
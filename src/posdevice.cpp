@@ -2,31 +2,27 @@
 #include "posdevice.h"
 #include "posdataanalyzer.h"
 #include "textstreamqueue.h"
-#include <rapidjson/document.h>
-#include <rapidjson/writer.h>
-#include <rapidjson/stringbuffer.h>
 #include "pos_db.h"
-#include <boost/algorithm/string.hpp>
-#include <boost/typeof/typeof.hpp>
 #include <string.h>
 #include "pos_terminal_parser.h"
 
 int POSDevice::mChnCnt = 0;
+std::string POSDevice::mSerialDev;
+bool POSDevice::mSerialMultiDrop = false;
 
 POSDevice::POSDevice(int PosId, const POS::ConfigInfo &Cfg)
-    : mPosCfgInfo(Cfg), m_pServId(NULL), mPosId(PosId),m_cd(libiconv_t(-1)),isStarted(false)
+    : mPosCfgInfo(Cfg), m_pServId(NULL), mPosId(PosId),isStarted(false)
 {
     m_pDisplayer = new TextStreamQueue(mPosId, &mPosCfgInfo);
     m_pAnalyzer = new PosDataAnalyzer(mPosId, &mPosCfgInfo);
 
-    if (mPosCfgInfo.Encoding != "UTF-8" && 0 == mPosCfgInfo.CommType){
-        m_cd = libiconv_open("UTF-8", mPosCfgInfo.Encoding.c_str());
-        if (m_cd == libiconv_t(-1)){
-            printf("POSDevice: libiconv_open(to=[UTF-8], from=[%s]) failed !\n",
-                   mPosCfgInfo.Encoding.c_str());
-        }
-    }
+    if (0 == mPosCfgInfo.CommType)
+        m_cvt.open(mPosCfgInfo.Encoding);
     memset(m_buf, 0x0, sizeof(m_buf));
+    memset(&m_lastIngest, 0, sizeof(m_lastIngest));
+    pthread_mutex_init(&m_lock, NULL);
+    m_tags = pos_net::tag_matcher(mPosCfgInfo.Start + mPosCfgInfo.Separator,
+                                  mPosCfgInfo.Separator, mPosCfgInfo.Stop);
     pos_net::parm PosPara;
     CreateServPara(PosPara);
     m_pServId = pos_net::start(PosPara);
@@ -35,32 +31,40 @@ POSDevice::POSDevice(int PosId, const POS::ConfigInfo &Cfg)
 POSDevice::~POSDevice()
 {
     pos_net::stop(&m_pServId);
-    if (m_cd != libiconv_t(-1)){
-        libiconv_close(m_cd);
-        m_cd = libiconv_t(-1);
-    }
     delete m_pDisplayer;
     delete m_pAnalyzer;
+    pthread_mutex_destroy(&m_lock);
 }
 
+/* only what changed is redone: a new port or tty restarts pos_net, new tags or encoding are swapped
+   in on the live socket, new channels start or stop just their compositors */
 void POSDevice::Config(const POS::ConfigInfo &Cfg)
 {
     bool bComposeParaChanged = false;
+    bool bChnsChanged = false;
     bool bEncodingChanged = false;
-    pos_net::stop(&m_pServId);
+    bool bTransportChanged = mPosCfgInfo.CommType != Cfg.CommType;
+    if (Cfg.CommType == 0) /* Serial */
+        bTransportChanged = bTransportChanged || mPosCfgInfo.Baudrate != Cfg.Baudrate
+            || mPosCfgInfo.DataBit != Cfg.DataBit || mPosCfgInfo.StopBit != Cfg.StopBit
+            || mPosCfgInfo.Check != Cfg.Check || mPosCfgInfo.Number != Cfg.Number;
+    else
+        bTransportChanged = bTransportChanged || mPosCfgInfo.Port != Cfg.Port;
+    /* stopping drains the dispatch thread, which takes m_lock */
+    if (bTransportChanged)
+        pos_net::stop(&m_pServId);
 
-    if (mPosCfgInfo.BoundChns != Cfg.BoundChns 
-        || mPosCfgInfo.ComposeType != Cfg.ComposeType
+    pthread_mutex_lock(&m_lock);
+    if (mPosCfgInfo.ComposeType != Cfg.ComposeType
         || mPosCfgInfo.FontSize != Cfg.FontSize)
     {
         m_pDisplayer->StopComposing();
         bComposeParaChanged = true;
     }
+    else if (mPosCfgInfo.BoundChns != Cfg.BoundChns)
+        bChnsChanged = true;
     if(Cfg.CommType == 0 && mPosCfgInfo.Encoding != Cfg.Encoding){
-        if (m_cd != libiconv_t(-1)){
-            libiconv_close(m_cd);
-            m_cd = libiconv_t(-1);
-        }
+        m_cvt.close();
         bEncodingChanged = true;
     }
 
@@ -70,8 +74,12 @@ void POSDevice::Config(const POS::ConfigInfo &Cfg)
     mPosCfgInfo.Stop = Cfg.Stop;
     mPosCfgInfo.Separator = Cfg.Separator;
     mPosCfgInfo.Encoding = Cfg.Encoding;
+    mPosCfgInfo.AesKey = Cfg.AesKey;
     mPosCfgInfo.CommType = Cfg.CommType;
-    mPosCfgInfo.BoundChns = Cfg.BoundChns;
+    if (bChnsChanged)
+        m_pDisplayer->SetChannels(Cfg.BoundChns);
+    else
+        mPosCfgInfo.BoundChns = Cfg.BoundChns;
     mPosCfgInfo.PosType = Cfg.PosType;
 	mPosCfgInfo.ComposeType = Cfg.ComposeType;
     mPosCfgInfo.FontSize = Cfg.FontSize;
@@ -91,25 +99,39 @@ void POSDevice::Config(const POS::ConfigInfo &Cfg)
     }
     isStarted = false;
     memset(m_buf, 0, 512);
-    if(bEncodingChanged){
-        if (mPosCfgInfo.Encoding != "UTF-8")
-        {
-            m_cd = libiconv_open("UTF-8", mPosCfgInfo.Encoding.c_str());
-            if (m_cd == libiconv_t(-1)){
-                printf("POSDevice: libiconv_open(to=[UTF-8], from=[%s]) failed !\n",
-                       mPosCfgInfo.Encoding.c_str());
-            }
-        }
-    }
+    m_tags = pos_net::tag_matcher(mPosCfgInfo.Start + mPosCfgInfo.Separator,
+                                  mPosCfgInfo.Separator, mPosCfgInfo.Stop);
+    if(bEncodingChanged)
+        m_cvt.open(mPosCfgInfo.Encoding);
 
     if (bComposeParaChanged){
         m_pDisplayer->resize(600, 700);//canvas size
         m_pDisplayer->StartComposing();
     }
+    pthread_mutex_unlock(&m_lock);
 
     pos_net::parm PosPara;
     CreateServPara(PosPara);
-    m_pServId = pos_net::start(PosPara);
+    if (!pos_net::reconfigure(m_pServId, PosPara))
+    {
+        pos_net::stop(&m_pServId);
+        m_pServId = pos_net::start(PosPara);
+    }
+}
+
+void POSDevice::GetIngestSnapshot(IngestSnapshot &Snap)
+{
+    pos_net::get_ingest_stats(m_pServId, Snap.Totals);
+    const pos_net::ingest_stats &Cur = Snap.Totals;
+    /* a restarted server counts from zero again */
+    if (Cur.uptime_ms < m_lastIngest.uptime_ms)
+        memset(&m_lastIngest, 0, sizeof(m_lastIngest));
+
+    double Secs = (Cur.uptime_ms - m_lastIngest.uptime_ms) / 1000.0;
+    Snap.BytesPerSec = Secs > 0 ? (Cur.bytes - m_lastIngest.bytes) / Secs : 0;
+    Snap.ItemsPerSec = Secs > 0 ? (Cur.items - m_lastIngest.items) / Secs : 0;
+    Snap.TransactionsPerSec = Secs > 0 ? (Cur.transactions - m_lastIngest.transactions) / Secs : 0;
+    m_lastIngest = Cur;
 }
 
 void POSDevice::PauseOsd(int ChnId)
@@ -138,35 +160,34 @@ void POSDevice::RestoreOsd(int ChnId)
 
 void POSDevice::on_data_loop(char *& buf, size_t& size)
 {
-    POS::ConfigInfo mPosCfgInfoTmp = mPosCfgInfo;
-    mPosCfgInfoTmp.Start += mPosCfgInfoTmp.Separator;
+    const std::string &Stop = m_tags.tag(pos_net::tag_matcher::TAG_STOP);
     while(size)
     {
+        pos_net::tag_matcher::state scan;
         if (!isStarted)
         {
-            if (size < mPosCfgInfoTmp.Start.size())
-                return;
-            BOOST_AUTO(r, boost::find_first(buf, mPosCfgInfoTmp.Start));
-            if (r.begin() == r.end())
+            size_t n = m_tags.find(pos_net::tag_matcher::TAG_START, buf, size, scan);
+            if (n == pos_net::tag_matcher::npos)
                 return;
             PosDataRecv(pos_net::CALLBACK_TYPE_START, NULL, this);
             isStarted = true;
-            size = buf + size - r.end();
-            strcpy(buf, buf + mPosCfgInfoTmp.Start.size());
+            size -= n;
+            memmove(buf, buf + n, size + 1);
             continue;
         }
-        if (mPosCfgInfoTmp.Separator.empty())
+        if (m_tags.tag(pos_net::tag_matcher::TAG_ITEM_SEP).empty())
         {
-            BOOST_AUTO(r, boost::find_first(buf, mPosCfgInfoTmp.Stop));
-            if (r.begin() == r.end())
+            size_t n = m_tags.find(pos_net::tag_matcher::TAG_STOP, buf, size, scan);
+            if (n == pos_net::tag_matcher::npos)
             {
                 PosDataRecv(pos_net::CALLBACK_TYPE_ITEM, buf, this);
                 memset(m_buf, 0, 512);
                 return;
             }
-            if (r.begin() != buf)
+            char *r = buf + n - Stop.size();
+            if (r != buf)
             {
-                *r.begin() = '\0';
+                *r = '\0';
                 PosDataRecv(pos_net::CALLBACK_TYPE_ITEM, buf, this);
             }
             isStarted = false;
@@ -174,15 +195,14 @@ void POSDevice::on_data_loop(char *& buf, size_t& size)
             PosDataRecv(pos_net::CALLBACK_TYPE_STOP, NULL, this);
             return;
         }
-        if (size < mPosCfgInfoTmp.Separator.size())
+        size_t n = m_tags.find(pos_net::tag_matcher::TAG_ITEM_SEP, buf, size, scan);
+        if (n == pos_net::tag_matcher::npos)
             return;
-        BOOST_AUTO(r, boost::find_first(buf, mPosCfgInfoTmp.Separator));
-        if (r.begin() == r.end())
-            return;
-        if (r.begin() != buf)
+        char *r = buf + n - m_tags.tag(pos_net::tag_matcher::TAG_ITEM_SEP).size();
+        if (r != buf)
         {
-            *r.begin() = '\0';
-            if (mPosCfgInfoTmp.Stop == buf){
+            *r = '\0';
+            if (Stop == buf){
                 PosDataRecv(pos_net::CALLBACK_TYPE_STOP, NULL, this);
                 isStarted = false;
                 memset(m_buf, 0, 512);
@@ -191,8 +211,8 @@ void POSDevice::on_data_loop(char *& buf, size_t& size)
                 PosDataRecv(pos_net::CALLBACK_TYPE_ITEM, buf, this);
             }
         }
-        size = buf + size - r.end();
-        strcpy(buf, r.end());
+        size -= n;
+        memmove(buf, buf + n, size + 1);
     }
 }
 
@@ -238,23 +258,23 @@ void POSDevice::remove_extra_space(char *txt, size_t &size)
 
 void POSDevice::convert_encoding(char *&buf, size_t &size)
 {
-    if (m_cd == libiconv_t(-1))
+    if (!m_cvt.active())
         return;
-    char *pi = buf;
-    char m_cvt_buf[512];
-    char *po = m_cvt_buf;
-    size_t in_left = size, out_left = sizeof(m_cvt_buf);
-    if (libiconv(m_cd, &pi, &in_left, &po, &out_left) == 0)
+    m_cvtBuf.resize(pos_net::encoding_converter::max_output(size));
+    size_t n = m_cvt.convert(buf, size, &m_cvtBuf[0]);
+    m_cvt.reset();
+    if (n < sizeof(m_buf))
     {
         memset(m_buf, 0, 512);
-        strcpy(m_buf, m_cvt_buf);
-        size = sizeof(m_cvt_buf) - out_left;
-        m_buf[size] = '\0';
+        memcpy(m_buf, &m_cvtBuf[0], n);
+        size = n;
     }
 }
 
 void POSDevice::Pos485String(char *buf)
 {
+    if (m_pServId) /* pos_net owns the tty */
+        return;
     size_t size = strlen(buf);
     if (mPosCfgInfo.PosType == pos_net::POS_TYPE_RECEIPTS)
     {
@@ -300,78 +320,108 @@ void POSDevice::CreateServPara(pos_net::parm &PosPara)
     PosPara.stop_tag = mPosCfgInfo.Stop;
     PosPara.item_sep = mPosCfgInfo.Separator;
     PosPara.encoding = mPosCfgInfo.Encoding;
-    PosPara.port = mPosCfgInfo.Port;
+    PosPara.aes_key = mPosCfgInfo.AesKey; /* expanded once per server, parsed lock-free on its io thread */
+    if (mPosCfgInfo.CommType == 0) /* Serial */
+    {
+        static const char parity[] = "NOEMS";
+        PosPara.device = mSerialDev;
+        PosPara.baudrate = 1200 << (mPosCfgInfo.Baudrate & 3);
+        PosPara.data_bits = 8 - (mPosCfgInfo.DataBit & 3);
+        PosPara.stop_bits = mPosCfgInfo.StopBit ? 2 : 1;
+        PosPara.parity = mPosCfgInfo.Check < 5 ? parity[mPosCfgInfo.Check] : 'N';
+        if (mSerialMultiDrop)
+            PosPara.bus_address = mPosCfgInfo.Number;
+    }
+    else
+        PosPara.port = mPosCfgInfo.Port;
     PosPara.user_parm = this;
-    PosPara.callback = POSDevice::PosDataRecv;
+    PosPara.batch_callback = POSDevice::PosDataBatch;
+    PosPara.terminal_records = true; /* decoded and checked once by pos_net, no json in between */
+    PosPara.queue_depth = 4096; /* rendering runs on the dispatch thread, not the io thread */
+    /* a lost start or stop would merge or split receipts in the analyzer, swipes and plaintext lines stand alone */
+    if (mPosCfgInfo.PosType == pos_net::POS_TYPE_RECEIPTS)
+        PosPara.overflow = pos_net::OVERFLOW_BLOCK;
+    /* a register that dies mid-receipt still gets its partial receipt stored */
+    PosPara.transaction_timeout_ms = 30 * 1000;
+    PosPara.idle_timeout_ms = 30 * 60 * 1000;
 }
 
+/* receipt lines of a batch are laid out together and rendered once */
+void POSDevice::PosDataBatch(const pos_net::item_view *items, size_t count,
+                             void *pObj)
+{
+    POSDevice *pThiz = static_cast<POSDevice *>(pObj);
+    pthread_mutex_lock(&pThiz->m_lock);
+    if (pThiz->mPosCfgInfo.PosType == pos_net::POS_TYPE_TERMINAL)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            if (items[i].record)
+                pThiz->PosTerminalRecv(*items[i].record);
+        }
+        pthread_mutex_unlock(&pThiz->m_lock);
+        return;
+    }
+    if (pThiz->mPosCfgInfo.PosType != pos_net::POS_TYPE_RECEIPTS)
+    {
+        for (size_t i = 0; i < count; i++)
+            PosDataRecv(items[i].type, items[i].item, pObj);
+        pthread_mutex_unlock(&pThiz->m_lock);
+        return;
+    }
+
+    std::vector<const char *> &texts = pThiz->m_texts;
+    texts.clear();
+    for (size_t i = 0; i < count; i++)
+    {
+        if (items[i].type == pos_net::CALLBACK_TYPE_STOP) /* item is pos_net::c_truncated on a timeout */
+            texts.push_back("\n");
+        else if (items[i].item)
+            texts.push_back(items[i].item);
+
+        pThiz->m_pAnalyzer->addItem(items[i].type, items[i].item, items[i].size);
+    }
+    pThiz->m_pDisplayer->Append(texts);
+    pthread_mutex_unlock(&pThiz->m_lock);
+}
+
+/* a swipe is shown as name:value lines and stored as pos_net filled it in */
+void POSDevice::PosTerminalRecv(const pos_net::terminal_record &Rec)
+{
+    std::string Text;
+    for (size_t i = 0; i < pos_net::c_terminal_field_count; i++)
+    {
+        const pos_net::terminal_field &Field = pos_net::c_terminal_fields[i];
+        Text += Field.name;
+        Text += ':';
+        Text += Field.of(Rec);
+        Text += '\n';
+    }
+    Text += '\n';
+    m_pDisplayer->Append(Text.c_str());
+
+    pos_db::terminal_row Row;
+    Row.pos_id = mPosId;
+    Row.pos_name = mPosCfgInfo.Name;
+    Row.relate_channels = mPosCfgInfo.BoundChns;
+    Row.rec = Rec;
+    pos_db::write_terminal_record(Row);
+}
+
+/* receipts and plaintext, terminal swipes go from PosDataBatch to PosTerminalRecv */
 void POSDevice::PosDataRecv(pos_net::e_callback_type type, const char *item,
                             void *pObj)
 {
     POSDevice *pThiz = static_cast<POSDevice *>(pObj);
     if (pThiz->mPosCfgInfo.PosType == pos_net::POS_TYPE_RECEIPTS)
     {
-        if (item)
-            pThiz->m_pDisplayer->Append(item);
-        else if (type == pos_net::CALLBACK_TYPE_STOP)
+        if (type == pos_net::CALLBACK_TYPE_STOP)
             pThiz->m_pDisplayer->Append("\n");
+        else if (item)
+            pThiz->m_pDisplayer->Append(item);
 
         pThiz->m_pAnalyzer->addItem(type, item);
     }
-    else if (pThiz->mPosCfgInfo.PosType == pos_net::POS_TYPE_TERMINAL)
-	{
-		const char *keywork[] = {"terminal_code","card_id","money","terminal_model","serial","time","pos_id","pos_name","relate_channels"};
-		char itemtext[256] ={0};
-		rapidjson::Document doc;	// Default template parameter uses UTF8 and MemoryPoolAllocator.
-		if (doc.Parse<0>(item).HasParseError())
-			return;
-
-		assert(doc.IsObject());	// Document is a JSON value represents the root of DOM. Root can be either an object or array.
-
-		for(int i = 0; i <6; i++)
-		{
-			assert(doc.HasMember(keywork[i]));
-            assert(doc[keywork[i]].IsString());
-            strcat(itemtext,keywork[i]);
-            strcat(itemtext,":");
-            strcat(itemtext,doc[keywork[i]].GetString());
-            strcat(itemtext,"\n");
-		}
-
-		strcat(itemtext,"\n");
-		
-		/*дҪڴַPOSID NAME BOUNDCHSֶ*/
-		doc.AddMember(rapidjson::StringRef(keywork[6]), pThiz->mPosId, doc.GetAllocator());
-		doc.AddMember(rapidjson::StringRef(keywork[7]), rapidjson::StringRef(pThiz->mPosCfgInfo.Name.c_str()), doc.GetAllocator());
-		rapidjson::Document::AllocatorType& allocator = doc.GetAllocator();
-		rapidjson::Value contact(rapidjson::kArrayType);
-	    for (size_t i = 0; i < pThiz->mPosCfgInfo.BoundChns.size(); i++)
-	    {
-			contact.PushBack(pThiz->mPosCfgInfo.BoundChns[i], allocator);
-	    }
-
-		doc.AddMember(rapidjson::StringRef(keywork[8]), contact, doc.GetAllocator());
-
-		rapidjson::StringBuffer sb;
-		rapidjson::Writer<rapidjson::StringBuffer> w(sb);
-		doc.Accept(w);
-		//жϽյǷ
-        if(strlen(doc["card_id"].GetString())> 20 || strlen(doc["terminal_code"].GetString()) > 8
-			|| strlen(doc["terminal_model"].GetString())> 16 || strlen(doc["serial"].GetString())> 8)
-		{
-			printf("Waring !!! The Param maybe too long or error , Please Check !!!");
-			return;
-		}
-		else
-		{
-            pThiz->m_pDisplayer->Append(itemtext);
-			//дݿ
-			std::string query_info = sb.GetString();
-			pos_db::write_terminal_record(query_info);
-			
-		    pThiz->m_pAnalyzer->addItem(type, sb.GetString());
-		}
-    }
     else
     {
         if (item)
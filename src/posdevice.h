@@ -2,9 +2,11 @@
 #define POSDEVICE_H
 
 
+#include <pthread.h>
 #include "posdefine.h"
 #include "pos_net.h"
-#include "iconv.h"
+#include "pos_tag_matcher.h"
+#include "pos_encoding.h"
 
 
 class PosDataAnalyzer;
@@ -21,12 +23,32 @@ public:
     void Pos485String(char *item);
     const std::string &Name() const { return mPosCfgInfo.Name; }
 
+    /* ingest totals of the device and the rates since the previous snapshot */
+    struct IngestSnapshot
+    {
+        pos_net::ingest_stats Totals;
+        double BytesPerSec;
+        double ItemsPerSec;
+        double TransactionsPerSec;
+    };
+    void GetIngestSnapshot(IngestSnapshot &Snap);
+
     static void SetChannelCount(int count) { mChnCnt = count; }
     static int ChannelCount() { return mChnCnt; }
+    /* tty read by pos_net for serial devices, empty = data is pushed through Pos485String,
+       bMultiDrop = rs-485 bus shared by registers addressed by ConfigInfo::Number */
+    static void SetSerialDevice(const std::string &dev, bool bMultiDrop = false)
+    {
+        mSerialDev = dev;
+        mSerialMultiDrop = bMultiDrop;
+    }
 
 private:
     static void PosDataRecv(pos_net::e_callback_type type, const char *item,
                             void *pObj);
+    static void PosDataBatch(const pos_net::item_view *items, size_t count,
+                             void *pObj);
+    void PosTerminalRecv(const pos_net::terminal_record &Rec);
 
     void CreateServPara(pos_net::parm &PosPara);
     void on_data_loop(char *& buf, size_t& size);
@@ -39,11 +61,18 @@ private:
     void *m_pServId;
     int mPosId;
 
-    libiconv_t m_cd;
+    pos_net::tag_matcher m_tags;
+    pos_net::encoding_converter m_cvt;
     bool isStarted;
     char m_buf[512];
+    std::vector<char> m_cvtBuf; /* convert_encoding output */
+    std::vector<const char *> m_texts;
+    pos_net::ingest_stats m_lastIngest;
+    pthread_mutex_t m_lock; /* mPosCfgInfo between Config and the dispatch thread */
 
     static int mChnCnt;
+    static std::string mSerialDev;
+    static bool mSerialMultiDrop;
 };
 
 #endif // POSDEVICE_H
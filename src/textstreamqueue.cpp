@@ -4,6 +4,7 @@
 #include "intf_media.h"
 #include "hi_type.h"
 #include "posdevice.h"
+#include <algorithm>
 
 
 TextStreamQueue::TextStreamQueue(int PosId, POS::ConfigInfo *pCfg)
@@ -13,6 +14,8 @@ TextStreamQueue::TextStreamQueue(int PosId, POS::ConfigInfo *pCfg)
 {
     m_bChnNeedPause.resize(POSDevice::ChannelCount(), false);
     m_bChnComposing.resize(POSDevice::ChannelCount(), false);
+    m_bChnNeedStop.resize(POSDevice::ChannelCount(), false);
+    pthread_mutex_init(&mLock, NULL);
 
     //ߣ600x700
     int w = 600;
@@ -34,6 +37,7 @@ TextStreamQueue::~TextStreamQueue()
 
     if (m_pPaintBuffer)
         delete m_pPaintBuffer;
+    pthread_mutex_destroy(&mLock);
 }
 
 void TextStreamQueue::resize(int w, int h)
@@ -59,6 +63,27 @@ void TextStreamQueue::resize(int w, int h)
 }
 
 void TextStreamQueue::Append(const char *text)
+{
+    pthread_mutex_lock(&mLock);
+    if (AppendRows(text))
+        Update();
+    pthread_mutex_unlock(&mLock);
+}
+
+/* lays out every text and updates the canvas once */
+void TextStreamQueue::Append(const std::vector<const char *> &texts)
+{
+    bool bChanged = false;
+    pthread_mutex_lock(&mLock);
+    for (size_t i = 0; i < texts.size(); i++)
+        bChanged = AppendRows(texts[i]) || bChanged;
+
+    if (bChanged)
+        Update();
+    pthread_mutex_unlock(&mLock);
+}
+
+bool TextStreamQueue::AppendRows(const char *text)
 {
     RSFontMetrics textInfo(text, m_pPosCfg->FontSize);
     textInfo.setWorpWrap(true);
@@ -66,7 +91,7 @@ void TextStreamQueue::Append(const char *text)
     RSStringList textLine = textInfo.subText();
 
     if (textLine.isEmpty())
-        return;
+        return false;
 
     if (mRowText.size() + textLine.size() > (int)mMaxRowCnt)
     {
@@ -86,7 +111,7 @@ void TextStreamQueue::Append(const char *text)
         mRowText.append(textLine[r]);
     }
 
-    Update();
+    return true;
 }
 
 void TextStreamQueue::Pause(int ChnId)
@@ -132,99 +157,22 @@ void TextStreamQueue::StartComposing()
 {
     m_bNeedComposing = true;
     m_bChnComposing.resize(POSDevice::ChannelCount(), false);
+    m_bChnNeedStop.assign(POSDevice::ChannelCount(), false);
 #if !defined(D1004NR)
 	if (m_pPosCfg->ComposeType == POS::CT_ViModule) 
 	{
-	    CIntfMedia *pCIntfMedia = CIntfMedia::Instance();
-	    RS_S32 s32Ret = 0;
-
 	    const std::vector<unsigned char> &BoundChns = m_pPosCfg->BoundChns;
 	    for (size_t ci = 0; ci < BoundChns.size(); ci++)
-	    {
-	        RS_S32 ChnId = BoundChns[ci];
-	        s32Ret = pCIntfMedia->StartGetViChnFrame(ChnId, mViIntelliParam);
-	        if(RS_SUCCESS != s32Ret)
-			{
-				int count = 0;
-				while(RS_SUCCESS != s32Ret)
-				{	
-					printf("[StartComposing]:StartGetViChnFrame failed, ChnID=%d,s32Ret=%x \n",ChnId, s32Ret);
-					sleep(1);
-					count++;
-					if(count > 3)
-						break;
-					s32Ret = pCIntfMedia->StartGetViChnFrame(ChnId, mViIntelliParam);
-				}
-				if(count > 3)
-					printf("[StartComposing]:StartGetViChnFrame failed three times,Stop trying ! ChnID=%d\n",ChnId);
-				else
-					printf("[StartComposing]:StartGetViChnFrame successed,ChnID=%d\n",ChnId);
-			}
-			else
-	            printf("[StartComposing]:StartGetViChnFrame successed,ChnID=%d\n",ChnId);
-	    }
-
-	    mCmpozInfo.resize(BoundChns.size());
-	    ComposingPara *pCmpzInfo = mCmpozInfo.data();
-	    for (RS_U32 i = 0; i < mCmpozInfo.size(); i++)
-	    {
-	        pCmpzInfo[i].pTSQueue = this;
-	        pCmpzInfo[i].pCIntfMedia = pCIntfMedia;
-	        pCmpzInfo[i].ChnId = m_pPosCfg->BoundChns[i];
-            pCmpzInfo[i].OsdInfo[0].stRect.x = 0;
-            pCmpzInfo[i].OsdInfo[0].stRect.y = 0;
-            pCmpzInfo[i].OsdInfo[0].stRect.w = m_pPaintBuffer->Width();
-            pCmpzInfo[i].OsdInfo[0].stRect.h = m_pPaintBuffer->Height();
-            pCmpzInfo[i].OsdInfo[0].enPixelFmt = RSPIXEL_FORMAT_RGB_1555;
-            pCmpzInfo[i].OsdInfo[0].u32BgAlpha = 0;
-            pCmpzInfo[i].OsdInfo[0].u32BgColor = 0x000000;
-            pCmpzInfo[i].OsdInfo[0].u32FgAlpha = 255;
-            pCmpzInfo[i].OsdInfo[0].u32PhyAddr = m_pPaintBuffer->PhysicalAddr();
-            pCmpzInfo[i].OsdInfo[0].u32Stride = m_pPaintBuffer->LineLength();
-            pCmpzInfo[i].OsdInfo[1].stRect.x = 0;
-            pCmpzInfo[i].OsdInfo[1].stRect.y = 0;
-            pCmpzInfo[i].OsdInfo[1].stRect.w = m_pPaintBuffer->SubWidth();
-            pCmpzInfo[i].OsdInfo[1].stRect.h = m_pPaintBuffer->SubHeight();
-            pCmpzInfo[i].OsdInfo[1].enPixelFmt = RSPIXEL_FORMAT_RGB_1555;
-            pCmpzInfo[i].OsdInfo[1].u32BgAlpha = 0;
-            pCmpzInfo[i].OsdInfo[1].u32BgColor = 0x000000;
-            pCmpzInfo[i].OsdInfo[1].u32FgAlpha = 255;
-            pCmpzInfo[i].OsdInfo[1].u32PhyAddr = m_pPaintBuffer->SubPhysicalAddr();
-            pCmpzInfo[i].OsdInfo[1].u32Stride = m_pPaintBuffer->SubLineLength();
-            pCmpzInfo[i].MinW = 0;
-            pCmpzInfo[i].MaxW = 0;
-
-	        pthread_t id;
-	        if (CreateNormalThread(TextStreamQueue::ComposingThread, pCmpzInfo + i, &id) == 0){
-				printf("[StartComposing]:CreateNormalThread(ComposingThread) successed,ChnID=%d\n",pCmpzInfo[i].ChnId);	
-			}else{
-				printf("[StartComposing]:CreateNormalThread(ComposingThread) failed,ChnID=%d\n",pCmpzInfo[i].ChnId);
-			}
-				
-	    }
+	        StartChannel(BoundChns[ci]);
 	}
 	else if (m_pPosCfg->ComposeType == POS::CT_VencModule)
 #endif
 	{	
-	    CIntfMedia *pCIntfMedia = CIntfMedia::Instance();
 	    const std::vector<unsigned char> &BoundChns = m_pPosCfg->BoundChns;
-		RS_RECT_S OsdRect;
-		OsdRect.x = 920;
-		OsdRect.y = 505;
-		OsdRect.w = mWidth;
-		OsdRect.h = mHeight;
 	    for (RS_U32 ci = 0; ci < BoundChns.size(); ci++)
-		{
-		#if defined(D1004NR)
-			if (m_pPosCfg->ComposeType == POS::CT_ViModule) 
-				pCIntfMedia->CreatePosOsdForVi(BoundChns[ci], OsdRect);
-			else
-				pCIntfMedia->CreatePosOsd(BoundChns[ci], OsdRect);
-		#else
-			pCIntfMedia->CreatePosOsd(BoundChns[ci], OsdRect);
-		#endif
-			
-		}
+	    {
+	        StartChannel(BoundChns[ci]);
+	    }
 		mCmpozInfo.resize(BoundChns.size());
 	    ComposingPara *pCmpzInfo = mCmpozInfo.data();
 		if(0 != mCmpozInfo.size()) // ûаͨʱ߳
@@ -263,7 +211,7 @@ void TextStreamQueue::StopComposing()
 	        if (bStoped)
 	            break;
 
-	        usleep(50000);
+	        mSleep(10);
 	    }
 
 	    CIntfMedia *pCIntfMedia = CIntfMedia::Instance();
@@ -299,25 +247,174 @@ void TextStreamQueue::StopComposing()
 			if (bStoped)
 				break;
 		
-			usleep(50000);
+			mSleep(10);
 		}
-		CIntfMedia *pCIntfMedia = CIntfMedia::Instance();
 	    const std::vector<unsigned char> &BoundChns = m_pPosCfg->BoundChns;
 	    for (RS_U32 ci = 0; ci < BoundChns.size(); ci++)
 	    {
-	    #if defined(D1004NR)
-		    if (m_pPosCfg->ComposeType == POS::CT_ViModule)
-				pCIntfMedia->DestroyPosOsdForVi(BoundChns[ci]);
-			else
-				pCIntfMedia->DestroyPosOsd(BoundChns[ci]);
-	    #else
-			pCIntfMedia->DestroyPosOsd(BoundChns[ci]);
-		#endif
-		}
+	        StopChannel(BoundChns[ci]);
+	    }
 		printf("==========DestroyPosOsd=============\n");
 	}
 }
 
+/* starts and stops only the compositors of the channels added or removed */
+void TextStreamQueue::SetChannels(const std::vector<unsigned char> &Chns)
+{
+    pthread_mutex_lock(&mLock);
+    std::vector<unsigned char> OldChns = m_pPosCfg->BoundChns;
+    m_pPosCfg->BoundChns = Chns;
+    for (size_t ci = 0; ci < OldChns.size(); ci++)
+    {
+        if (std::find(Chns.begin(), Chns.end(), OldChns[ci]) == Chns.end())
+            StopChannel(OldChns[ci]);
+    }
+    pthread_mutex_unlock(&mLock);
+
+    /* a compositor may need mLock before it sees its stop */
+    for (size_t ci = 0; ci < Chns.size(); ci++)
+    {
+        if (std::find(OldChns.begin(), OldChns.end(), Chns[ci]) == OldChns.end())
+            WaitChannelStopped(Chns[ci]);
+    }
+
+    pthread_mutex_lock(&mLock);
+    for (size_t ci = 0; ci < Chns.size(); ci++)
+    {
+        if (std::find(OldChns.begin(), OldChns.end(), Chns[ci]) == OldChns.end())
+            StartChannel(Chns[ci]);
+    }
+
+#if !defined(D1004NR)
+	if (m_pPosCfg->ComposeType == POS::CT_VencModule)
+#endif
+	{
+	    /* CanvasClear runs while a channel is bound */
+	    if (Chns.empty())
+	        m_bEndThread = true;
+	    else if (OldChns.empty())
+	    {
+	        m_bEndThread = false;
+	        /* unless the previous one has not left yet */
+	        if (mCmpozInfo.empty() || !m_bChnComposing[mCmpozInfo[0].ChnId])
+	        {
+	            mCmpozInfo.resize(1);
+	            mCmpozInfo[0].pTSQueue = this;
+	            mCmpozInfo[0].ChnId = Chns[0];
+	            CreateNormalThread(TextStreamQueue::CanvasClear, mCmpozInfo.data(), NULL);
+	        }
+	    }
+	    Update(); /* the added channels show the current text */
+	}
+    pthread_mutex_unlock(&mLock);
+}
+
+/* removed and added again before its compositor saw it, called without mLock */
+void TextStreamQueue::WaitChannelStopped(RS_U8 ChnId)
+{
+#if !defined(D1004NR)
+	if (m_pPosCfg->ComposeType == POS::CT_ViModule)
+	{
+	    while (m_bChnComposing[ChnId] && m_bChnNeedStop[ChnId])
+	        mSleep(10);
+	}
+#endif
+}
+
+void TextStreamQueue::StartChannel(RS_U8 ChnId)
+{
+    CIntfMedia *pCIntfMedia = CIntfMedia::Instance();
+#if !defined(D1004NR)
+	if (m_pPosCfg->ComposeType == POS::CT_ViModule)
+	{
+	    if (m_bChnComposing[ChnId])
+	        return;
+
+	    m_bChnNeedStop[ChnId] = false;
+	    /* a failed start is retried by ComposingThread */
+	    RS_S32 s32Ret = pCIntfMedia->StartGetViChnFrame(ChnId, mViIntelliParam);
+	    if (RS_SUCCESS != s32Ret)
+	        printf("[StartChannel]:StartGetViChnFrame failed, ChnID=%d,s32Ret=%x \n", ChnId, s32Ret);
+	    else
+	        printf("[StartChannel]:StartGetViChnFrame successed,ChnID=%d\n", ChnId);
+
+	    /* owned by the thread */
+	    ComposingPara *pCmpzInfo = new ComposingPara;
+	    pCmpzInfo->pTSQueue = this;
+	    pCmpzInfo->pCIntfMedia = pCIntfMedia;
+	    pCmpzInfo->ChnId = ChnId;
+	    pCmpzInfo->OsdInfo[0].stRect.x = 0;
+	    pCmpzInfo->OsdInfo[0].stRect.y = 0;
+	    pCmpzInfo->OsdInfo[0].stRect.w = m_pPaintBuffer->Width();
+	    pCmpzInfo->OsdInfo[0].stRect.h = m_pPaintBuffer->Height();
+	    pCmpzInfo->OsdInfo[0].enPixelFmt = RSPIXEL_FORMAT_RGB_1555;
+	    pCmpzInfo->OsdInfo[0].u32BgAlpha = 0;
+	    pCmpzInfo->OsdInfo[0].u32BgColor = 0x000000;
+	    pCmpzInfo->OsdInfo[0].u32FgAlpha = 255;
+	    pCmpzInfo->OsdInfo[0].u32PhyAddr = m_pPaintBuffer->PhysicalAddr();
+	    pCmpzInfo->OsdInfo[0].u32Stride = m_pPaintBuffer->LineLength();
+	    pCmpzInfo->OsdInfo[1].stRect.x = 0;
+	    pCmpzInfo->OsdInfo[1].stRect.y = 0;
+	    pCmpzInfo->OsdInfo[1].stRect.w = m_pPaintBuffer->SubWidth();
+	    pCmpzInfo->OsdInfo[1].stRect.h = m_pPaintBuffer->SubHeight();
+	    pCmpzInfo->OsdInfo[1].enPixelFmt = RSPIXEL_FORMAT_RGB_1555;
+	    pCmpzInfo->OsdInfo[1].u32BgAlpha = 0;
+	    pCmpzInfo->OsdInfo[1].u32BgColor = 0x000000;
+	    pCmpzInfo->OsdInfo[1].u32FgAlpha = 255;
+	    pCmpzInfo->OsdInfo[1].u32PhyAddr = m_pPaintBuffer->SubPhysicalAddr();
+	    pCmpzInfo->OsdInfo[1].u32Stride = m_pPaintBuffer->SubLineLength();
+	    pCmpzInfo->MinW = 0;
+	    pCmpzInfo->MaxW = 0;
+
+	    m_bChnComposing[ChnId] = true;
+	    pthread_t id;
+	    if (CreateNormalThread(TextStreamQueue::ComposingThread, pCmpzInfo, &id) == 0)
+	        printf("[StartChannel]:CreateNormalThread(ComposingThread) successed,ChnID=%d\n", ChnId);
+	    else
+	    {
+	        printf("[StartChannel]:CreateNormalThread(ComposingThread) failed,ChnID=%d\n", ChnId);
+	        m_bChnComposing[ChnId] = false;
+	        delete pCmpzInfo;
+	    }
+	    return;
+	}
+#endif
+	RS_RECT_S OsdRect;
+	OsdRect.x = 920;
+	OsdRect.y = 505;
+	OsdRect.w = mWidth;
+	OsdRect.h = mHeight;
+#if defined(D1004NR)
+	if (m_pPosCfg->ComposeType == POS::CT_ViModule)
+		pCIntfMedia->CreatePosOsdForVi(ChnId, OsdRect);
+	else
+		pCIntfMedia->CreatePosOsd(ChnId, OsdRect);
+#else
+	pCIntfMedia->CreatePosOsd(ChnId, OsdRect);
+#endif
+}
+
+void TextStreamQueue::StopChannel(RS_U8 ChnId)
+{
+#if !defined(D1004NR)
+	if (m_pPosCfg->ComposeType == POS::CT_ViModule)
+	{
+	    /* the thread stops the capture on its way out, nothing to wait for */
+	    m_bChnNeedStop[ChnId] = true;
+	    return;
+	}
+#endif
+    CIntfMedia *pCIntfMedia = CIntfMedia::Instance();
+#if defined(D1004NR)
+	if (m_pPosCfg->ComposeType == POS::CT_ViModule)
+		pCIntfMedia->DestroyPosOsdForVi(ChnId);
+	else
+		pCIntfMedia->DestroyPosOsd(ChnId);
+#else
+	pCIntfMedia->DestroyPosOsd(ChnId);
+#endif
+}
+
 void *TextStreamQueue::CanvasClear(void *Para)
 {
 	ComposingPara *pCmpzInfo = static_cast<ComposingPara *>(Para);
@@ -336,9 +433,11 @@ void *TextStreamQueue::CanvasClear(void *Para)
 			pThiz->mTickClean++;
             if (pThiz->mTickClean >= 100) // ten sec
             {
+                pthread_mutex_lock(&pThiz->mLock);
                 pThiz->m_pPaintBuffer->Clear();
 				pThiz->mRowText.clear();
 				pThiz->Update();  
+                pthread_mutex_unlock(&pThiz->mLock);
             }
         }		
 	}
@@ -362,16 +461,18 @@ void *TextStreamQueue::ComposingThread(void *Para)
 	int s32Count = 0;
 
     pThiz->m_bChnComposing[ChnId] = true;
-    while (pThiz->m_bNeedComposing)
+    while (pThiz->m_bNeedComposing && !pThiz->m_bChnNeedStop[ChnId])
     {
         if (pThiz->mTickCnt)
         {
             pThiz->mTickCnt++;
             if (pThiz->mTickCnt > 400 * pThiz->m_pPosCfg->BoundChns.size())
             {
+                pthread_mutex_lock(&pThiz->mLock);
                 pThiz->mTickCnt = 0;
                 pThiz->m_pPaintBuffer->Clear();
 				pThiz->mRowText.clear();
+                pthread_mutex_unlock(&pThiz->mLock);
             }
         }
 
@@ -513,7 +614,11 @@ void *TextStreamQueue::ComposingThread(void *Para)
             printf("[ComposingThread]:FreeViChnFrame failed %x\n",s32Ret);
     }
 
+    /* removed by SetChannels, StopComposing stops the capture of all */
+    if (pThiz->m_bChnNeedStop[ChnId])
+        pCIntfMedia->StopGetViChnFrame(ChnId, stViIntelliParam);
     pThiz->m_bChnComposing[ChnId] = false;
+    delete pCmpzInfo;
 #endif
     return NULL;
 }
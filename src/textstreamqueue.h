@@ -3,6 +3,8 @@
 
 
 #include <deque>
+#include <pthread.h>
+#include <boost/atomic.hpp>
 #include "cosd.h"
 #include "canvas.h"
 #include "posdefine.h"
@@ -18,10 +20,12 @@ public:
 
     void resize(int w, int h);
     void Append(const char *text);
+    void Append(const std::vector<const char *> &texts);
     void Pause(int ChnId);
     void Restore(int ChnId);
     void StartComposing();
     void StopComposing();
+    void SetChannels(const std::vector<unsigned char> &Chns);
     Canvas *PaintBuffer() const { return m_pPaintBuffer; }
 
 private:
@@ -39,14 +43,30 @@ private:
 
     void Composing();
     void Update();
+    bool AppendRows(const char *text);
+    void WaitChannelStopped(RS_U8 ChnId);
+    void StartChannel(RS_U8 ChnId);
+    void StopChannel(RS_U8 ChnId);
+
+    /* a flag of one channel, set and read by the threads of different channels at once */
+    struct ChnFlag
+    {
+        ChnFlag(bool b = false) : v(b) {}
+        ChnFlag(const ChnFlag &o) : v(o.v.load()) {}
+        ChnFlag &operator=(const ChnFlag &o) { v = o.v.load(); return *this; }
+        ChnFlag &operator=(bool b) { v = b; return *this; }
+        operator bool() const { return v; }
+        boost::atomic<bool> v;
+    };
 
 
     RSStringList mRowText;
     std::vector<ComposingPara> mCmpozInfo;
     std::vector<int> mRowYPos;
     std::vector<bool> m_bRowTextChanged;
-    std::vector<bool> m_bChnComposing;
-    std::vector<bool> m_bChnNeedPause;
+    std::vector<ChnFlag> m_bChnComposing;
+    std::vector<ChnFlag> m_bChnNeedPause;
+    std::vector<ChnFlag> m_bChnNeedStop;
 #if !defined(D1004NR)
     VI_INTELLI_PARAM_S mViIntelliParam;
 #endif
@@ -64,6 +84,7 @@ private:
     bool m_bScrolled;
     bool m_bNeedComposing;
 	bool m_bEndThread;
+    pthread_mutex_t mLock; /* rows, canvas and bound channels */
 };
 
 #endif // TEXTSTREAMQUEUE_H
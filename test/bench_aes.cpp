@@ -0,0 +1,54 @@
+// decryption of 128 byte DPOS bodies by each AES engine against the FFmul reference, make bench runs it
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include "pos_terminal_parser.h"
+
+using namespace pos_net;
+
+static double now()
+{
+	timeval t;
+	gettimeofday(&t, NULL);
+	return t.tv_sec + t.tv_usec / 1e6;
+}
+
+static const size_t c_body_len = 128;
+
+// bodies per second of e, 0 when this cpu lacks it
+static double bench(e_aes_engine e, unsigned long bodies)
+{
+	if (!set_aes_engine(e))
+		return 0;
+	unsigned char body[c_body_len];
+	for (size_t i=0; i<c_body_len; ++i)
+		body[i] = (unsigned char)(i * 7);
+	const terminal_key& key = terminal_key::builtin();
+	double t = now();
+	for (unsigned long i=0; i<bodies; ++i)
+		aes_dec(body, c_body_len, key);
+	t = now() - t;
+	// keeps the loop from being dropped
+	volatile unsigned char sink = body[0];
+	(void)sink;
+	return bodies / t;
+}
+
+int main()
+{
+	static const char *c_names[] = { "reference", "ttable", "aesni" };
+	e_aes_engine picked = get_aes_engine();
+	double ref = bench(AES_ENGINE_REFERENCE, 20000);
+	printf("%-10s %10.0f bodies/s %8.1f MB/s\n", c_names[AES_ENGINE_REFERENCE], ref, ref * c_body_len / 1e6);
+	const e_aes_engine engines[] = { AES_ENGINE_TTABLE, AES_ENGINE_AESNI };
+	for (size_t i=0; i<sizeof(engines)/sizeof(engines[0]); ++i)
+	{
+		double r = bench(engines[i], 2000000);
+		if (!r)
+			printf("%-10s not on this cpu\n", c_names[engines[i]]);
+		else
+			printf("%-10s %10.0f bodies/s %8.1f MB/s  x%.1f\n", c_names[engines[i]], r, r * c_body_len / 1e6, r / ref);
+	}
+	set_aes_engine(picked);
+	return 0;
+}
@@ -0,0 +1,88 @@
+// throughput of the framers behind open_framer, in reads of a tcp segment, make bench runs it
+#include <stdio.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <string>
+#include "pos_net.h"
+#include "pos_terminal_parser.h"
+
+using namespace pos_net;
+
+static unsigned long s_items = 0;
+
+static void on_batch(const item_view *, size_t count, void *)
+{
+	s_items += count;
+}
+
+static double now()
+{
+	timeval t;
+	gettimeofday(&t, NULL);
+	return t.tv_sec + t.tv_usec / 1e6;
+}
+
+static const size_t c_read = 1460;
+static const size_t c_bytes = 64 << 20;	// fed per case
+
+static void bench(const char *name, const parm& p, const std::string& unit)
+{
+	std::string in;
+	while (in.size() < (1 << 20))
+		in += unit;
+	void *f = open_framer(p);
+	s_items = 0;
+	size_t fed = 0;
+	double t = now();
+	while (fed < c_bytes)
+	{
+		for (size_t off=0; off<in.size(); off+=c_read)
+			feed(f, in.data() + off, std::min(c_read, in.size() - off));
+		fed += in.size();
+	}
+	t = now() - t;
+	close_framer(&f);
+	printf("%-24s %8.1f MB/s %10.0f items/s\n", name, fed / t / 1e6, s_items / t);
+}
+
+static parm receipts(const char *item_sep, const char *encoding)
+{
+	parm p;
+	p.start_tag = "START";
+	p.stop_tag = "END";
+	p.item_sep = item_sep;
+	p.encoding = encoding;
+	p.batch_callback = on_batch;
+	return p;
+}
+
+int main()
+{
+	std::string ascii = "START\nmilk 1L            1 x 1.00\nbread whole wheat     2 x 2.50\n"
+		"eggs 12               1 x 3.20\nTOTAL                     9.20\nEND\n";
+	std::string gbk = "START\n\xc5\xa3\xc4\xcc 1L             1 x 1.00\n\xc3\xe6\xb0\xfc \xc8\xab\xc2\xf3          2 x 2.50\n"
+		"\xbc\xa6\xb5\xb0 12                1 x 3.20\n\xba\xcf\xbc\xc6                      9.20\nEND\n";
+
+	bench("receipts", receipts("\n", ""), ascii);
+	bench("receipts gbk", receipts("\n", "GBK"), gbk);
+	bench("receipts no item_sep", receipts("", ""), ascii);
+
+	parm p = receipts("", "");
+	p.type = POS_TYPE_PLAINTEXT;
+	bench("plaintext", p, ascii);
+	p.encoding = "GBK";
+	bench("plaintext gbk", p, gbk);
+
+	std::string fields[6] = { "1", "6225880012345678", "9.50", "4", "12345678", "20170417112459" };
+	p = parm();
+	p.type = POS_TYPE_TERMINAL;
+	p.batch_callback = on_batch;
+	p.terminal_records = true;
+	bench("terminal records", p, make_terminal_msg(fields));
+	p.terminal_records = false;
+	bench("terminal json", p, make_terminal_msg(fields));
+	fields[1] = "\xc5\xa3\xc4\xcc";
+	p.encoding = "GBK";
+	bench("terminal json gbk", p, make_terminal_msg(fields));
+	return 0;
+}
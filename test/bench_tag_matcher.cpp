@@ -0,0 +1,111 @@
+// tag_matcher against the boost::find_first rescan it replaced, on receipts arriving in reads of
+// a few sizes, make bench runs it
+#include <stdio.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <string>
+#include <boost/algorithm/string/find.hpp>
+#include "pos_tag_matcher.h"
+
+using namespace pos_net;
+
+static double now()
+{
+	timeval t;
+	gettimeofday(&t, NULL);
+	return t.tv_sec + t.tv_usec / 1e6;
+}
+
+static const size_t c_bytes = 64 << 20;	// fed per case
+
+// bytes received but not yet framed, items are consumed from the front
+struct pending
+{
+	std::string buf;
+	size_t begin;
+
+	pending() : begin(0) {}
+
+	void append(const char *p, size_t n)
+	{
+		if (begin > buf.size() / 2)
+		{
+			buf.erase(0, begin);
+			begin = 0;
+		}
+		buf.append(p, n);
+	}
+};
+
+// before : every read searches the whole pending data again
+static size_t frame_rescan(pending& in, const std::string& sep)
+{
+	size_t items = 0;
+	for (;;)
+	{
+		boost::iterator_range<const char *> range(in.buf.data() + in.begin, in.buf.data() + in.buf.size());
+		boost::iterator_range<const char *> r = boost::find_first(range, sep);
+		if (r.empty())
+			return items;
+		in.begin = r.end() - in.buf.data();
+		++items;
+	}
+}
+
+// after : the search resumes where the previous read left it
+static size_t frame_resume(pending& in, const tag_matcher& tags, tag_matcher::state& st)
+{
+	size_t items = 0;
+	for (;;)
+	{
+		size_t n = tags.find(tag_matcher::TAG_ITEM_SEP, in.buf.data() + in.begin, in.buf.size() - in.begin, st);
+		if (n == tag_matcher::npos)
+			return items;
+		in.begin += n;
+		st.reset();
+		++items;
+	}
+}
+
+static void bench(const char *name, const std::string& unit, size_t read)
+{
+	std::string in;
+	while (in.size() < (1 << 20))
+		in += unit;
+	const std::string sep = "\r\n";
+	tag_matcher tags("START", sep, "END");
+
+	double t[2];
+	size_t items[2] = { 0, 0 };
+	for (int k=0; k<2; ++k)
+	{
+		pending p;
+		tag_matcher::state st;
+		t[k] = now();
+		for (size_t fed=0; fed<c_bytes; fed+=in.size())
+		{
+			for (size_t off=0; off<in.size(); off+=read)
+			{
+				p.append(in.data() + off, std::min(read, in.size() - off));
+				items[k] += k ? frame_resume(p, tags, st) : frame_rescan(p, sep);
+			}
+		}
+		t[k] = now() - t[k];
+	}
+	if (items[0] != items[1])
+		printf("%s : %lu items rescanning, %lu resuming\n", name, (unsigned long)items[0], (unsigned long)items[1]);
+	printf("%-28s rescan %8.1f MB/s  resume %8.1f MB/s  x%.1f\n", name, c_bytes / t[0] / 1e6, c_bytes / t[1] / 1e6, t[0] / t[1]);
+}
+
+int main()
+{
+	std::string line = "milk 1L                 1 x 1.00\r\n";
+	std::string longline = std::string(4000, 'x') + "\r\n";
+	std::string crs = std::string(2000, '\r') + "\r\n";	// partial separators all along
+	bench("short lines, 1460 reads", line, 1460);
+	bench("short lines, 16 byte reads", line, 16);
+	bench("4 KB lines, 1460 reads", longline, 1460);
+	bench("4 KB lines, 64 byte reads", longline, 64);
+	bench("runs of \\r, 64 byte reads", crs, 64);
+	return 0;
+}
@@ -0,0 +1,125 @@
+// libFuzzer target of the framers behind open_framer, built by make fuzz with clang; make check builds
+// it with a main of its own that replays the files and directories it is given, the seed corpus in
+// corpus/framers among them
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "pos_net.h"
+#include "pos_terminal_parser.h"
+
+using namespace pos_net;
+
+static void on_batch(const item_view *items, size_t count, void *)
+{
+	for (size_t i=0; i<count; ++i)
+	{
+		const item_view& v = items[i];
+		if (v.item && v.item[v.size])
+			abort();
+		if (v.record)
+		{
+			for (size_t j=0; j<c_terminal_field_count; ++j)
+			{
+				const terminal_field& f = c_terminal_fields[j];
+				if (!memchr(f.of(*v.record), '\0', f.size))
+					abort();
+			}
+		}
+	}
+}
+
+static const char *c_encodings[] = { "", "GBK", "GB18030", "BIG5" };
+
+// data[0] picks the parm : type (bits 0-1), item_sep (2), encoding (3-4), "END" or "END\n" as stop tag (5),
+// udp (6), terminal_records (7); data[1] is the read size, 0 = the rest in one read
+extern "C" int LLVMFuzzerTestOneInput(const unsigned char *data, size_t size)
+{
+	if (size < 2)
+		return 0;
+	unsigned char c = data[0];
+	size_t chunk = data[1];
+	data += 2;
+	size -= 2;
+
+	parm p;
+	switch (c & 3)
+	{
+	case 0 :
+	case 3 :
+		p.type = POS_TYPE_RECEIPTS;
+		break;
+	case 1 :
+		p.type = POS_TYPE_TERMINAL;
+		break;
+	case 2 :
+		p.type = POS_TYPE_PLAINTEXT;
+		break;
+	}
+	p.start_tag = "START";
+	p.stop_tag = (c & 0x20) ? "END\n" : "END";
+	if (c & 0x04)
+		p.item_sep = "\n";
+	p.encoding = c_encodings[(c >> 3) & 3];
+	p.proto = (c & 0x40) ? PROTO_UDP : PROTO_TCP;
+	p.terminal_records = (c & 0x80) != 0;
+	p.max_line = 4096;
+	p.batch_callback = on_batch;
+
+	void *f = open_framer(p);
+	if (!chunk)
+		chunk = size;
+	for (size_t off=0; off<size; off+=chunk)
+		feed(f, (const char *)data + off, std::min(chunk, size - off));
+	close_framer(&f);
+	return 0;
+}
+
+#ifndef POS_LIBFUZZER
+static void run_file(const std::string& path)
+{
+	FILE *fp = fopen(path.c_str(), "rb");
+	if (!fp)
+	{
+		printf("fuzz_framers: cannot open %s\n", path.c_str());
+		exit(1);
+	}
+	std::vector<unsigned char> buf;
+	unsigned char b[4096];
+	size_t n;
+	while ((n = fread(b, 1, sizeof(b), fp)) > 0)
+		buf.insert(buf.end(), b, b + n);
+	fclose(fp);
+	LLVMFuzzerTestOneInput(buf.empty() ? NULL : &buf[0], buf.size());
+}
+
+int main(int argc, char **argv)
+{
+	size_t runs = 0;
+	for (int i=1; i<argc; ++i)
+	{
+		struct stat st;
+		if (stat(argv[i], &st) || !S_ISDIR(st.st_mode))
+		{
+			run_file(argv[i]);
+			++runs;
+			continue;
+		}
+		DIR *d = opendir(argv[i]);
+		while (struct dirent *e = readdir(d))
+		{
+			if (e->d_name[0] == '.')
+				continue;
+			run_file(std::string(argv[i]) + "/" + e->d_name);
+			++runs;
+		}
+		closedir(d);
+	}
+	printf("fuzz_framers: %d inputs ok\n", (int)runs);
+	return 0;
+}
+#endif
@@ -0,0 +1,120 @@
+// load generator : simulated registers against a pos_net server on localhost, the rate is stepped up
+// until transactions are lost or the registers fall behind, then the highest sustained rate and the
+// latency percentiles of the steps are printed
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include "pos_loadgen.h"
+
+using namespace pos_net;
+
+static void usage()
+{
+	printf("usage: load_gen [options]\n"
+		"  -m receipts|terminal|plaintext  framing (receipts)\n"
+		"  -u                              udp instead of tcp\n"
+		"  -P port                         server port (29400)\n"
+		"  -r registers                    simulated registers (100)\n"
+		"  -t tps                          transactions per second of each register in the first step (1)\n"
+		"  -k factor                       rate factor of each following step (2)\n"
+		"  -n steps                        most steps (8)\n"
+		"  -d ms                           length of a step (2000)\n"
+		"  -i items                        items per receipt (8)\n"
+		"  -s tag -e tag -S sep            start tag, stop tag, item separator (START, END, \\n), \\n \\r \\t are unescaped\n"
+		"  -E encoding                     register encoding, e.g. GBK (none)\n"
+		"  -q depth                        parm::queue_depth of the server (0)\n"
+		"  -l listeners                    parm::listeners of the server (1)\n");
+}
+
+static std::string unescape(const char *s)
+{
+	std::string ret;
+	for (; *s; ++s)
+	{
+		if (*s != '\\' || !s[1])
+		{
+			ret += *s;
+			continue;
+		}
+		switch (*++s)
+		{
+		case 'n' : ret += '\n'; break;
+		case 'r' : ret += '\r'; break;
+		case 't' : ret += '\t'; break;
+		default : ret += *s;
+		}
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	load_parm p;
+	p.server.port = 29400;
+	p.server.start_tag = "START";
+	p.server.stop_tag = "END";
+	p.server.item_sep = "\n";
+	int c;
+	while ((c = getopt(argc, argv, "m:uP:r:t:k:n:d:i:s:e:S:E:q:l:h")) != -1)
+	{
+		switch (c)
+		{
+		case 'm' :
+			if (!strcmp(optarg, "receipts"))
+				p.server.type = POS_TYPE_RECEIPTS;
+			else if (!strcmp(optarg, "terminal"))
+				p.server.type = POS_TYPE_TERMINAL;
+			else if (!strcmp(optarg, "plaintext"))
+				p.server.type = POS_TYPE_PLAINTEXT;
+			else
+			{
+				usage();
+				return 2;
+			}
+			break;
+		case 'u' : p.server.proto = PROTO_UDP; break;
+		case 'P' : p.server.port = (unsigned short)atoi(optarg); break;
+		case 'r' : p.registers = (unsigned int)atoi(optarg); break;
+		case 't' : p.rate = atof(optarg); break;
+		case 'k' : p.ramp = atof(optarg); break;
+		case 'n' : p.steps = (unsigned int)atoi(optarg); break;
+		case 'd' : p.step_ms = (unsigned int)atoi(optarg); break;
+		case 'i' : p.items = (unsigned int)atoi(optarg); break;
+		case 's' : p.server.start_tag = unescape(optarg); break;
+		case 'e' : p.server.stop_tag = unescape(optarg); break;
+		case 'S' : p.server.item_sep = unescape(optarg); break;
+		case 'E' : p.server.encoding = optarg; break;
+		case 'q' : p.server.queue_depth = (size_t)atoi(optarg); break;
+		case 'l' : p.server.listeners = (unsigned int)atoi(optarg); break;
+		default :
+			usage();
+			return c == 'h' ? 0 : 2;
+		}
+	}
+
+	load_report report;
+	if (!load_test(p, report))
+		return 1;
+	printf("%12s %12s %8s %8s %10s %10s %10s %10s\n", "offered/s", "delivered/s", "sent", "lost", "p50 us", "p99 us", "p999 us", "max us");
+	for (size_t i=0; i<report.steps.size(); ++i)
+	{
+		const load_step& s = report.steps[i];
+		printf("%12.0f %12.0f %8lu %8lu %10llu %10llu %10llu %10llu%s\n", s.offered_tps, s.delivered_tps, s.sent, s.lost,
+			s.p50_us, s.p99_us, s.p999_us, s.max_us, s.sustained ? "" : "  not sustained");
+	}
+	// the percentiles of the fastest step that kept up
+	const load_step *best = NULL;
+	for (size_t i=0; i<report.steps.size(); ++i)
+	{
+		if (report.steps[i].sustained)
+			best = &report.steps[i];
+	}
+	if (best)
+		printf("max sustained %.0f transactions/s : p50 %llu us, p99 %llu us, p999 %llu us\n",
+			report.max_sustained_tps, best->p50_us, best->p99_us, best->p999_us);
+	else
+		printf("no step was sustained\n");
+	return 0;
+}
@@ -0,0 +1,47 @@
+// replays a capture recorded through parm::capture_path against a running pos_net server
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "pos_capture.h"
+
+using namespace pos_net;
+
+static void usage()
+{
+	printf("usage: replay [options] capture\n"
+		"  -u          udp, a datagram per record, instead of a tcp connection per captured stream\n"
+		"  -H host     server address (127.0.0.1)\n"
+		"  -P port     server port\n"
+		"  -x speed    1 = the captured pace (default), N = N times faster, 0 = back to back\n");
+}
+
+int main(int argc, char **argv)
+{
+	replay_parm p;
+	int c;
+	while ((c = getopt(argc, argv, "uH:P:x:h")) != -1)
+	{
+		switch (c)
+		{
+		case 'u' : p.proto = PROTO_UDP; break;
+		case 'H' : p.host = optarg; break;
+		case 'P' : p.port = (unsigned short)atoi(optarg); break;
+		case 'x' : p.speed = atof(optarg); break;
+		default :
+			usage();
+			return c == 'h' ? 0 : 2;
+		}
+	}
+	if (optind != argc - 1 || !p.port || p.speed < 0)
+	{
+		usage();
+		return 2;
+	}
+	p.file = argv[optind];
+
+	replay_stats stats;
+	if (!replay(p, stats))
+		return 1;
+	printf("%lu records of %lu streams, %llu bytes in %.3f s\n", stats.records, stats.streams, stats.bytes, stats.elapsed_us / 1e6);
+	return 0;
+}
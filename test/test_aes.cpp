@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <string.h>
+#include "pos_terminal_parser.h"
+
+using namespace pos_net;
+
+static int s_failed = 0;
+
+#define CHECK(x) do { if (!(x)) { printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #x); ++s_failed; } } while (0)
+
+// LCG of the keys and bodies, the same on every platform
+static unsigned int s_seed = 1;
+
+static unsigned char rnd()
+{
+	s_seed = s_seed * 1103515245 + 12345;
+	return (unsigned char)(s_seed >> 16);
+}
+
+static const size_t c_body_len = 128;	// of a DPOS frame
+static const e_aes_engine c_engines[] = { AES_ENGINE_TTABLE, AES_ENGINE_AESNI };
+static const char *c_engine_names[] = { "reference", "ttable", "aesni" };
+
+// every engine decrypts random bodies under random keys as the FFmul reference does, and
+// the reference undoes aes_enc
+static void test_engines_agree()
+{
+	e_aes_engine picked = get_aes_engine();
+	for (int k=0; k<200; ++k)
+	{
+		unsigned char raw[16];
+		for (size_t i=0; i<sizeof(raw); ++i)
+			raw[i] = rnd();
+		terminal_key key(raw);
+		unsigned char plain[c_body_len], body[c_body_len], ref[c_body_len];
+		for (size_t i=0; i<c_body_len; ++i)
+			plain[i] = rnd();
+
+		memcpy(body, plain, c_body_len);
+		aes_enc(body, c_body_len, key);
+		CHECK(set_aes_engine(AES_ENGINE_REFERENCE));
+		memcpy(ref, body, c_body_len);
+		aes_dec(ref, c_body_len, key);
+		CHECK(!memcmp(ref, plain, c_body_len));
+
+		// random bytes decrypt to the same garbage too
+		for (size_t i=0; i<c_body_len; ++i)
+			body[i] = rnd();
+		memcpy(ref, body, c_body_len);
+		aes_dec(ref, c_body_len, key);
+
+		for (size_t e=0; e<sizeof(c_engines)/sizeof(c_engines[0]); ++e)
+		{
+			if (!set_aes_engine(c_engines[e]))
+			{
+				CHECK(c_engines[e] == AES_ENGINE_AESNI);
+				if (!k)
+					printf("test_aes: no %s on this cpu\n", c_engine_names[c_engines[e]]);
+				continue;
+			}
+			unsigned char out[c_body_len];
+			memcpy(out, body, c_body_len);
+			aes_dec(out, c_body_len, key);
+			if (memcmp(out, ref, c_body_len))
+			{
+				printf("test_aes: %s differs from the reference, key %d\n", c_engine_names[c_engines[e]], k);
+				++s_failed;
+			}
+		}
+	}
+	set_aes_engine(picked);
+}
+
+int main()
+{
+	test_engines_agree();
+	if (s_failed)
+	{
+		printf("test_aes: %d failed\n", s_failed);
+		return 1;
+	}
+	printf("test_aes: ok\n");
+	return 0;
+}
@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <boost/asio.hpp>
+#include "pos_capture.h"
+
+using namespace pos_net;
+
+static int s_failed = 0;
+
+#define CHECK(x) do { if (!(x)) { printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #x); ++s_failed; } } while (0)
+
+// events of the server running, as S| I:item| E|
+static ho::mutex s_mutex;
+static std::string s_events;
+
+static void on_event(e_callback_type type, const char *item, void *)
+{
+	static const char c_types[] = { 'S', 'I', 'E' };
+	ho::lock_guard lock(s_mutex);
+	s_events += c_types[type];
+	if (item)
+		(s_events += ':') += item;
+	s_events += '|';
+}
+
+static std::string events()
+{
+	ho::lock_guard lock(s_mutex);
+	return s_events;
+}
+
+// the events once they stop changing
+static std::string settle()
+{
+	std::string last = events();
+	for (int i=0; i<50; ++i)
+	{
+		usleep(20000);
+		std::string now = events();
+		if (now == last && i > 2)
+			break;
+		last = now;
+	}
+	return last;
+}
+
+static void *start_server(e_proto proto, unsigned short port, const std::string& capture)
+{
+	parm p;
+	p.proto = proto;
+	p.port = port;
+	p.start_tag = "START";
+	p.stop_tag = "END";
+	p.item_sep = "\n";
+	p.encoding = "GBK";
+	p.capture_path = capture;
+	p.callback = on_event;
+	void *h = start(p);
+	usleep(50000);
+	{
+		ho::lock_guard lock(s_mutex);
+		s_events.clear();
+	}
+	return h;
+}
+
+// receipts cut mid-tag and mid-character, with pauses so the capture has a pace to keep
+static const char *c_writes[] =
+{
+	"junk START\nmilk 1.00\n\xc5\xa3",
+	"\xc4\xcc 2.00\nEN",
+	"D\nSTART\nbread\nEND\n",
+};
+static const size_t c_write_num = sizeof(c_writes) / sizeof(c_writes[0]);
+static const unsigned int c_pause_us = 100000;
+
+static void send_tcp(unsigned short port)
+{
+	using namespace boost::asio::ip;
+	boost::asio::io_service io;
+	tcp::socket s(io);
+	s.connect(tcp::endpoint(address_v4::loopback(), port));
+	for (size_t i=0; i<c_write_num; ++i)
+	{
+		if (i)
+			usleep(c_pause_us);
+		boost::asio::write(s, boost::asio::buffer(c_writes[i], strlen(c_writes[i])));
+	}
+	usleep(50000);
+}
+
+static void send_udp(unsigned short port)
+{
+	using namespace boost::asio::ip;
+	boost::asio::io_service io;
+	udp::socket s(io, udp::endpoint(udp::v4(), 0));
+	for (size_t i=0; i<c_write_num; ++i)
+	{
+		if (i)
+			usleep(c_pause_us);
+		s.send_to(boost::asio::buffer(c_writes[i], strlen(c_writes[i])), udp::endpoint(address_v4::loopback(), port));
+	}
+}
+
+// captures what a client sends to one server, replays it to a second at speed and compares the events
+static void round_trip(const char *name, e_proto proto, unsigned short port, double speed)
+{
+	std::string path = std::string("test_capture_") + name + ".cap";
+	void *h = start_server(proto, port, path);
+	if (proto == PROTO_TCP)
+		send_tcp(port);
+	else
+		send_udp(port);
+	std::string captured = settle();
+	stop(&h);
+
+	h = start_server(proto, port + 1, "");
+	replay_parm rp;
+	rp.file = path;
+	rp.proto = proto;
+	rp.port = port + 1;
+	rp.speed = speed;
+	replay_stats stats;
+	CHECK(replay(rp, stats));
+	std::string replayed = settle();
+	stop(&h);
+	unlink(path.c_str());
+
+	printf("%-8s x%-4g %lu records in %.3f s : %s\n", name, speed, stats.records, stats.elapsed_us / 1e6, replayed.c_str());
+	CHECK(captured == "S|I:milk 1.00|I:\xe7\x89\x9b\xe5\xa5\xb6 2.00|E|S|I:bread|E|");
+	CHECK(replayed == captured);
+	CHECK(stats.records == c_write_num);
+	CHECK(stats.streams == 1);
+	// the pauses between the writes, kept at 1x and shrunk at 10x
+	unsigned long long paced_us = (c_write_num - 1) * c_pause_us;
+	if (speed == 1)
+		CHECK(stats.elapsed_us >= paced_us * 9 / 10);
+	else
+		CHECK(stats.elapsed_us < paced_us / 2);
+}
+
+int main()
+{
+	round_trip("tcp", PROTO_TCP, 29311, 1);
+	round_trip("tcp", PROTO_TCP, 29313, 10);
+	round_trip("udp", PROTO_UDP, 29315, 1);
+	round_trip("udp", PROTO_UDP, 29317, 10);
+	if (s_failed)
+	{
+		printf("test_capture: %d failed\n", s_failed);
+		return 1;
+	}
+	printf("test_capture: ok\n");
+	return 0;
+}
@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "pos_encoding.h"
+
+using namespace pos_net;
+
+static int s_failed = 0;
+
+#define CHECK(x) do { if (!(x)) { printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #x); ++s_failed; } } while (0)
+
+static const size_t c_guard = 16;
+
+// in through encoding in reads of chunk bytes, each into a buffer of exactly max_output(n) followed by a guard
+static std::string convert(const char *encoding, const std::string& in, size_t chunk, unsigned long *invalid = NULL)
+{
+	encoding_converter cvt;
+	CHECK(cvt.open(encoding));
+	std::string ret;
+	for (size_t off=0; off<in.size(); off+=chunk)
+	{
+		size_t n = std::min(chunk, in.size() - off);
+		size_t room = encoding_converter::max_output(n);
+		std::vector<char> out(room + c_guard, '\xaa');
+		size_t m = cvt.convert(in.data() + off, n, &out[0]);
+		CHECK(m <= room);
+		CHECK(std::string(&out[room], c_guard) == std::string(c_guard, '\xaa'));
+		ret.append(&out[0], m);
+	}
+	if (invalid)
+		*invalid = cvt.invalid();
+	return ret;
+}
+
+static std::string repeat(const char *s, size_t n)
+{
+	std::string ret;
+	for (size_t i=0; i<n; ++i)
+		ret += s;
+	return ret;
+}
+
+static const size_t c_chunks[] = { 1, 2, 3, 5, 7, 512, 4096 };
+static const size_t c_chunk_num = sizeof(c_chunks) / sizeof(c_chunks[0]);
+
+// a lone 0x80 is the euro sign in CP936, three UTF-8 bytes out of one
+static void test_euro_run()
+{
+	std::string in(4000, '\x80');
+	std::string euro = repeat("\xe2\x82\xac", in.size());
+	for (size_t i=0; i<c_chunk_num; ++i)
+	{
+		unsigned long invalid = 0;
+		std::string out = convert("CP936", in, c_chunks[i], &invalid);
+		CHECK(out.size() == euro.size());
+		CHECK(out == euro);
+		CHECK(invalid == 0);
+		CHECK(convert("GBK", in, c_chunks[i]) == euro);
+	}
+}
+
+// four byte GB18030 sequences, split at every offset by the reads
+static void test_gb18030_four_byte()
+{
+	// U+0080 and U+10000
+	std::string in = repeat("\x81\x30\x81\x30\x90\x30\x81\x30", 1000);
+	std::string expect = repeat("\xc2\x80\xf0\x90\x80\x80", 1000);
+	for (size_t i=0; i<c_chunk_num; ++i)
+	{
+		unsigned long invalid = 0;
+		std::string out = convert("GB18030", in, c_chunks[i], &invalid);
+		CHECK(out.size() == expect.size());
+		CHECK(out == expect);
+		CHECK(invalid == 0);
+	}
+}
+
+// the table path with its carried bytes gives what one read of everything gives
+static void test_chunking()
+{
+	static const char *c_encodings[] = { "GBK", "GB18030", "BIG5" };
+	static const char *c_pieces[] = { "abc ", "\xc5\xa3\xc4\xcc", "\x80", "\xa4\x40", "\x81\x30\x81\x30", "\xff", "\x81" };
+	srand(1);
+	for (size_t e=0; e<sizeof(c_encodings)/sizeof(c_encodings[0]); ++e)
+	{
+		for (int round=0; round<50; ++round)
+		{
+			std::string in;
+			for (int i=0; i<200; ++i)
+				in += c_pieces[rand() % (sizeof(c_pieces)/sizeof(c_pieces[0]))];
+			std::string whole = convert(c_encodings[e], in, in.size());
+			for (size_t i=0; i<c_chunk_num; ++i)
+				CHECK(convert(c_encodings[e], in, c_chunks[i]) == whole);
+		}
+	}
+}
+
+int main()
+{
+	test_euro_run();
+	test_gb18030_four_byte();
+	test_chunking();
+	printf("test_encoding: %s\n", s_failed ? "FAILED" : "ok");
+	return s_failed ? 1 : 0;
+}
@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include "pos_net.h"
+
+using namespace pos_net;
+
+static int s_failed = 0;
+
+#define CHECK(x) do { if (!(x)) { printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #x); ++s_failed; } } while (0)
+
+// the events of a framer as text, S| for a START, I:item| for an ITEM, E| or E:item| for a STOP
+static std::string s_events;
+
+static void on_event(e_callback_type type, const char *item, void *)
+{
+	static const char c_types[] = { 'S', 'I', 'E' };
+	s_events += c_types[type];
+	if (item)
+		(s_events += ':') += item;
+	s_events += '|';
+}
+
+struct framing
+{
+	e_pos_type type;
+	const char *item_sep;
+	const char *stop_tag;
+	const char *encoding;
+	size_t max_line;
+};
+
+static parm make_parm(const framing& f)
+{
+	parm p;
+	p.type = f.type;
+	p.start_tag = "BEGIN";
+	p.stop_tag = f.stop_tag;
+	p.item_sep = f.item_sep;
+	p.encoding = f.encoding;
+	p.max_line = f.max_line;
+	p.callback = on_event;
+	return p;
+}
+
+// the events and counters of in fed in reads of the sizes chunks cycles through, 0 = the rest
+static std::string frame(const framing& f, const std::string& in, const size_t *chunks, size_t chunk_num)
+{
+	void *fr = open_framer(make_parm(f));
+	s_events.clear();
+	for (size_t off=0, i=0; off<in.size(); ++i)
+	{
+		size_t n = chunks[i % chunk_num];
+		n = n ? std::min(n, in.size() - off) : in.size() - off;
+		feed(fr, in.data() + off, n);
+		off += n;
+	}
+	session_stats session;
+	ingest_stats totals;
+	get_framer_stats(fr, session, totals);
+	close_framer(&fr);
+	char counters[128];
+	sprintf(counters, "#%lu %lu %llu %llu %llu", session.items, session.transactions, totals.resyncs, totals.encoding_errors, totals.overflows);
+	return s_events + counters;
+}
+
+static std::string frame(const framing& f, const std::string& in)
+{
+	static const size_t c_whole = 0;
+	return frame(f, in, &c_whole, 1);
+}
+
+static const framing c_receipts = { POS_TYPE_RECEIPTS, "\n", "END", "", 64 * 1024 };
+static const framing c_receipts_nosep = { POS_TYPE_RECEIPTS, "", "END", "", 64 * 1024 };
+static const framing c_receipts_gbk = { POS_TYPE_RECEIPTS, "\n", "END", "GBK", 64 * 1024 };
+static const framing c_plaintext = { POS_TYPE_PLAINTEXT, "", "END", "", 64 * 1024 };
+
+// the framers against events written out by hand
+static void test_expected()
+{
+	CHECK(frame(c_receipts, "xx BEGIN\nmilk 1.00\nbread\nEND\n") == "S|I:milk 1.00|I:bread|E|#2 1 0 0 0");
+	// a start tag inside a transaction is an item
+	CHECK(frame(c_receipts, "BEGIN\nmilk\nBEGIN\nbread\nEND\n") == "S|I:milk|I:BEGIN|I:bread|E|#3 1 0 0 0");
+	CHECK(frame(c_receipts_nosep, "BEGINmilk 1.00 bread 2.50END") == "S|I:milk 1.00 bread 2.50|E|#1 1 0 0 0");
+	CHECK(frame(c_receipts_gbk, "BEGIN\n\xc5\xa3\xc4\xcc\nEND\n") == "S|I:\xe7\x89\x9b\xe5\xa5\xb6|E|#1 1 0 0 0");
+	// a plaintext item is a read, tags and item_sep do not apply
+	CHECK(frame(c_plaintext, "line one\nline two\n") == "I:line one\nline two\n|#1 0 0 0 0");
+	const size_t reads[] = { 9, 0 };
+	CHECK(frame(c_plaintext, "line one\nline two\n", reads, 2) == "I:line one\n|I:line two\n|#2 0 0 0 0");
+}
+
+// LCG of the generated streams, the same on every platform
+static unsigned int s_seed;
+
+static unsigned int rnd()
+{
+	s_seed = s_seed * 1103515245 + 12345;
+	return (s_seed >> 16) & 0x7fff;
+}
+
+// tags, cut tags, separators, GBK, spaces, binary bytes and words
+static std::string generate(const framing& f)
+{
+	std::string s;
+	int n = 20 + rnd() % 200;
+	for (int i=0; i<n; ++i)
+	{
+		switch (rnd() % 10)
+		{
+		case 0 : s += "BEGIN"; break;
+		case 1 : s += f.stop_tag; break;
+		case 2 :
+		case 3 : s += *f.item_sep ? f.item_sep : "\n"; break;
+		case 4 : s += "\xc5\xa3\xc4\xcc"; break;
+		case 5 : s += "  "; break;
+		case 6 : s += (char)(rnd() % 256); break;
+		case 7 : s += "BE"; break;
+		default :
+			for (int k=1+rnd()%12; k; --k)
+				s += (char)('a' + rnd() % 26);
+		}
+	}
+	return s;
+}
+
+static const char *c_type_names[] = { "receipts", "terminal", "plaintext" };
+
+static std::string name(const framing& f)
+{
+	std::string ret = c_type_names[f.type];
+	ret += *f.item_sep ? " item_sep" : "";
+	ret += strchr(f.stop_tag, '\n') ? " END\\n" : " END";
+	ret += *f.encoding ? " GBK" : "";
+	ret += f.max_line < 64 ? " max_line 16" : "";
+	return ret;
+}
+
+// FNV-1a of the events of the generated streams of f, each fed in reads of random sizes
+static unsigned long long hash_framing(const framing& f, unsigned int seed, int streams)
+{
+	s_seed = seed;
+	unsigned long long h = 14695981039346656037ULL;
+	for (int i=0; i<streams; ++i)
+	{
+		std::string in = generate(f);
+		size_t chunks[16];
+		for (size_t j=0; j<16; ++j)
+			chunks[j] = 1 + rnd() % (rnd() % 4 ? 700 : 5);
+		std::string out = frame(f, in, chunks, 16);
+		for (size_t j=0; j<out.size(); ++j)
+			h = (h ^ (unsigned char)out[j]) * 1099511628211ULL;
+	}
+	return h;
+}
+
+// every combination of stop tag, separator, encoding and line cap the receipt framers are specialized
+// on, and the plaintext framer by encoding and line cap, with the hash of their events as the generic
+// framer (a branch on the type and on item_sep per read) produced them before the specialization;
+// --print lists the hashes of this build
+static const size_t c_framing_num = 16;
+static const framing c_framings[c_framing_num] =
+{
+	{ POS_TYPE_RECEIPTS, "", "END", "", 64 * 1024 },
+	{ POS_TYPE_RECEIPTS, "", "END", "", 16 },
+	{ POS_TYPE_RECEIPTS, "", "END", "GBK", 64 * 1024 },
+	{ POS_TYPE_RECEIPTS, "", "END", "GBK", 16 },
+	{ POS_TYPE_RECEIPTS, "", "END\n", "", 64 * 1024 },
+	{ POS_TYPE_RECEIPTS, "", "END\n", "", 16 },
+	{ POS_TYPE_RECEIPTS, "", "END\n", "GBK", 64 * 1024 },
+	{ POS_TYPE_RECEIPTS, "", "END\n", "GBK", 16 },
+	{ POS_TYPE_RECEIPTS, "\n", "END", "", 64 * 1024 },
+	{ POS_TYPE_RECEIPTS, "\n", "END", "", 16 },
+	{ POS_TYPE_RECEIPTS, "\n", "END", "GBK", 64 * 1024 },
+	{ POS_TYPE_RECEIPTS, "\n", "END", "GBK", 16 },
+	{ POS_TYPE_PLAINTEXT, "", "END", "", 64 * 1024 },
+	{ POS_TYPE_PLAINTEXT, "", "END", "", 16 },
+	{ POS_TYPE_PLAINTEXT, "", "END", "GBK", 64 * 1024 },
+	{ POS_TYPE_PLAINTEXT, "", "END", "GBK", 16 },
+};
+static const unsigned long long c_generic_hashes[c_framing_num] =
+{
+	0xf738f3e2f24a8f56ULL,	// receipts END
+	0x5f89d99be55246cfULL,	// receipts END max_line 16
+	0xb9138711fb1caba9ULL,	// receipts END GBK
+	0xc62ea6648017c541ULL,	// receipts END GBK max_line 16
+	0x674d86028f785e1aULL,	// receipts END\n
+	0x2593af1a7a2831f9ULL,	// receipts END\n max_line 16
+	0x660f27acbfc9782aULL,	// receipts END\n GBK
+	0x14dea5b8e3d1ff69ULL,	// receipts END\n GBK max_line 16
+	0xe0128bd58a65322eULL,	// receipts item_sep END
+	0x63f5135dc2e28ea7ULL,	// receipts item_sep END max_line 16
+	0x2d2b8b5a9d0a7e54ULL,	// receipts item_sep END GBK
+	0x6810957c3675c1c5ULL,	// receipts item_sep END GBK max_line 16
+	0x5c84b00bcced60c3ULL,	// plaintext END
+	0xaa6f8aba70ffe7aaULL,	// plaintext END max_line 16
+	0x99bdd76432fc0358ULL,	// plaintext END GBK
+	0xf707ab224dfe9ee5ULL,	// plaintext END GBK max_line 16
+};
+static const int c_streams = 50;
+
+static void test_generic(bool print)
+{
+	for (size_t i=0; i<c_framing_num; ++i)
+	{
+		unsigned long long h = hash_framing(c_framings[i], (unsigned int)i, c_streams);
+		if (print)
+			printf("\t0x%016llxULL,\t// %s\n", h, name(c_framings[i]).c_str());
+		else if (h != c_generic_hashes[i])
+		{
+			printf("%s : events differ from the generic framer\n", name(c_framings[i]).c_str());
+			++s_failed;
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	bool print = argc > 1 && !strcmp(argv[1], "--print");
+	if (!print)
+		test_expected();
+	test_generic(print);
+	if (s_failed)
+	{
+		printf("test_framers: %d failed\n", s_failed);
+		return 1;
+	}
+	if (!print)
+		printf("test_framers: ok\n");
+	return 0;
+}
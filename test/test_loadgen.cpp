@@ -0,0 +1,52 @@
+#include <stdio.h>
+#include "pos_loadgen.h"
+
+using namespace pos_net;
+
+static int s_failed = 0;
+
+#define CHECK(x) do { if (!(x)) { printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #x); ++s_failed; } } while (0)
+
+// one short step of a few registers, every transaction must come back through the framer and its
+// field limits
+static void run(const char *name, e_pos_type type, e_proto proto, const char *encoding, unsigned short port)
+{
+	load_parm p;
+	p.server.type = type;
+	p.server.proto = proto;
+	p.server.port = port;
+	p.server.start_tag = "START";
+	p.server.stop_tag = "END";
+	p.server.item_sep = "\n";
+	p.server.encoding = encoding;
+	p.registers = 4;
+	p.rate = 25;
+	p.steps = 1;
+	p.step_ms = 400;
+	load_report report;
+	CHECK(load_test(p, report));
+	CHECK(report.steps.size() == 1);
+	if (report.steps.empty())
+		return;
+	const load_step& s = report.steps[0];
+	printf("%-20s sent=%lu lost=%lu p50=%lluus\n", name, s.sent, s.lost, s.p50_us);
+	CHECK(s.sent > 0);
+	CHECK(s.lost == 0);
+	CHECK(s.sustained);
+}
+
+int main()
+{
+	run("receipts tcp", POS_TYPE_RECEIPTS, PROTO_TCP, "", 29301);
+	run("receipts gbk udp", POS_TYPE_RECEIPTS, PROTO_UDP, "GBK", 29302);
+	run("plaintext tcp", POS_TYPE_PLAINTEXT, PROTO_TCP, "", 29303);
+	run("terminal tcp", POS_TYPE_TERMINAL, PROTO_TCP, "", 29304);
+	run("terminal udp", POS_TYPE_TERMINAL, PROTO_UDP, "", 29305);
+	if (s_failed)
+	{
+		printf("test_loadgen: %d failed\n", s_failed);
+		return 1;
+	}
+	printf("test_loadgen: ok\n");
+	return 0;
+}
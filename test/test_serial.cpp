@@ -0,0 +1,203 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include "net_driver.h"
+#include "pos_net.h"
+
+using namespace pos_net;
+
+static int s_failed = 0;
+
+#define CHECK(x) do { if (!(x)) { printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #x); ++s_failed; } } while (0)
+
+// events of each device as S| I:item| E|, user_parm points at the string of the device
+static ho::mutex s_mutex;
+
+static void on_event(e_callback_type type, const char *item, void *user)
+{
+	static const char c_types[] = { 'S', 'I', 'E' };
+	ho::lock_guard lock(s_mutex);
+	std::string& events = *(std::string *)user;
+	events += c_types[type];
+	if (item)
+		(events += ':') += item;
+	events += '|';
+}
+
+static std::string events(const std::string& e)
+{
+	ho::lock_guard lock(s_mutex);
+	return e;
+}
+
+// the events once they stop changing
+static std::string settle(const std::string& e)
+{
+	std::string last = events(e);
+	for (int i=0; i<50; ++i)
+	{
+		usleep(20000);
+		std::string now = events(e);
+		if (now == last && i > 2)
+			break;
+		last = now;
+	}
+	return last;
+}
+
+// master side of a pty, the server opens the slave as its tty
+static int open_pty(std::string& slave)
+{
+	int fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (fd < 0 || grantpt(fd) || unlockpt(fd))
+	{
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	slave = ptsname(fd);
+	return fd;
+}
+
+static void put(int fd, const std::string& s)
+{
+	CHECK(write(fd, s.data(), s.size()) == (ssize_t)s.size());
+	usleep(20000);
+}
+
+static parm com_parm(const std::string& device, std::string *events)
+{
+	parm p;
+	p.proto = PROTO_COM;
+	p.device = device;
+	p.baudrate = 115200;
+	p.start_tag = "START";
+	p.stop_tag = "END";
+	p.item_sep = "\n";
+	p.callback = on_event;
+	p.user_parm = events;
+	return p;
+}
+
+// a register on its own tty, receipts cut across writes
+static void test_receipts()
+{
+	std::string slave;
+	int m = open_pty(slave);
+	CHECK(m >= 0);
+	if (m < 0)
+		return;
+	std::string e;
+	void *h = start(com_parm(slave, &e));
+	CHECK(h != NULL);
+	put(m, "noise START\nmi");
+	put(m, "lk 1.00\nEN");
+	put(m, "D\nSTART\nbread\nEND\n");
+	CHECK(settle(e) == "S|I:milk 1.00|E|S|I:bread|E|");
+	stop(&h);
+	close(m);
+}
+
+// STX, address, length, payload
+static std::string packet(unsigned char address, const std::string& payload)
+{
+	std::string s;
+	s += '\x02';
+	s += (char)address;
+	s += (char)payload.size();
+	return s + payload;
+}
+
+// devices 5 and 9 of a multi-drop bus, 7 is on another box; payloads are cut across packets and
+// packets across writes
+static void test_bus()
+{
+	std::string slave;
+	int m = open_pty(slave);
+	CHECK(m >= 0);
+	if (m < 0)
+		return;
+	std::string e5, e9;
+	parm p = com_parm(slave, &e5);
+	p.bus_address = 5;
+	void *h5 = start(p);
+	p.bus_address = 9;
+	p.user_parm = &e9;
+	void *h9 = start(p);
+	CHECK(h5 && h9);
+	p.bus_address = 5;
+	CHECK(start(p) == NULL);	// address taken
+
+	std::string bus = "line noise" + packet(5, "START\nmilk") + packet(7, "START\nnot ours\nEND\n")
+		+ packet(9, "START\nbread\nEND\n") + packet(5, "\nEND\n") + packet(0, "bad address") + packet(9, "START\n");
+	bus += packet(9, "eggs\nEND\n");
+	for (size_t i=0; i<bus.size(); i+=7)
+		put(m, bus.substr(i, 7));
+	CHECK(settle(e5) == "S|I:milk|E|");
+	CHECK(settle(e9) == "S|I:bread|E|S|I:eggs|E|");
+	stop(&h5);
+	stop(&h9);
+	close(m);
+}
+
+// the master going away is a read error on the tty, the server closes it and reopens the path; a new
+// pty mostly gets the freed slave number back, the reopen is only checked then
+static void test_reopen()
+{
+	std::string slave;
+	int m = open_pty(slave);
+	CHECK(m >= 0);
+	if (m < 0)
+		return;
+	std::string e;
+	void *h = start(com_parm(slave, &e));
+	CHECK(h != NULL);
+	put(m, "START\nbefore\nEND\n");
+	CHECK(settle(e) == "S|I:before|E|");
+
+	close(m);
+	ingest_stats stats;
+	for (int i=0; i<50; ++i)
+	{
+		get_ingest_stats(h, stats);
+		if (stats.port_errors)
+			break;
+		usleep(20000);
+	}
+	CHECK(stats.port_errors >= 1);
+
+	std::string again;
+	m = open_pty(again);
+	if (m >= 0 && again == slave)
+	{
+		std::string want = "S|I:before|E|S|I:after|E|";
+		for (int i=0; i<20 && events(e).find(want) != 0; ++i)
+		{
+			put(m, "START\nafter\nEND\n");
+			usleep(200000);
+		}
+		CHECK(events(e).find(want) == 0);
+	}
+	else
+		printf("test_serial: %s came back as %s, reopen not checked\n", slave.c_str(), again.c_str());
+	stop(&h);
+	if (m >= 0)
+		close(m);
+}
+
+int main()
+{
+	test_receipts();
+	test_bus();
+	test_reopen();
+	if (s_failed)
+	{
+		printf("test_serial: %d failed\n", s_failed);
+		return 1;
+	}
+	printf("test_serial: ok\n");
+	return 0;
+}
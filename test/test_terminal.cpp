@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "pos_net.h"
+#include "pos_terminal_parser.h"
+
+using namespace pos_net;
+
+static int s_failed = 0;
+
+#define CHECK(x) do { if (!(x)) { printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #x); ++s_failed; } } while (0)
+
+static std::vector<std::string> s_serials;
+
+static void on_batch(const item_view *items, size_t count, void *)
+{
+	for (size_t i=0; i<count; ++i)
+	{
+		if (items[i].record)
+			s_serials.push_back(items[i].record->serial);
+	}
+}
+
+static std::string frame(const char *serial)
+{
+	std::string f[6] = { "1", "6225880012345678", "9.50", "4", serial, "20170417112459" };
+	return make_terminal_msg(f);
+}
+
+// a frame whose last field runs to the end of the body without a NUL, as a body decrypted with
+// the wrong key does
+static std::string unterminated_frame()
+{
+	std::string body = "1$622$9.50$4$9$";
+	body.resize(128, 'A');
+	aes_enc(&body[0], body.size());
+	return "DPOS$1$128$" + body;
+}
+
+// frames fed in reads of chunk bytes, the serials of the records decoded
+static std::vector<std::string> feed_frames(const std::string& in, size_t chunk, session_stats& session)
+{
+	parm p;
+	p.type = POS_TYPE_TERMINAL;
+	p.batch_callback = on_batch;
+	p.terminal_records = true;
+	void *f = open_framer(p);
+	CHECK(f != NULL);
+	s_serials.clear();
+	for (size_t off=0; off<in.size(); off+=chunk)
+		feed(f, in.data() + off, std::min(chunk, in.size() - off));
+	ingest_stats totals;
+	get_framer_stats(f, session, totals);
+	close_framer(&f);
+	return s_serials;
+}
+
+// the bad body must not be walked past into the "DPOS$" of the frame behind it
+static void test_unterminated_body()
+{
+	std::string in = unterminated_frame() + frame("1") + frame("2");
+	const size_t chunks[] = { 1, 7, 139, in.size() };
+	for (size_t i=0; i<sizeof(chunks)/sizeof(chunks[0]); ++i)
+	{
+		session_stats session;
+		std::vector<std::string> serials = feed_frames(in, chunks[i], session);
+		CHECK(serials.size() == 2);
+		CHECK(serials.size() == 2 && serials[0] == "1" && serials[1] == "2");
+		CHECK(session.frames == 3);
+		CHECK(session.resyncs == 1);
+	}
+}
+
+// a frame one byte short of its body is refused rather than decrypted past its end
+static void test_short_body()
+{
+	terminal_record rec;
+	std::string m = frame("1");
+	CHECK(!parse_terminal_msg(&m[0], m.size() - 1, rec));
+	m = frame("1");
+	CHECK(parse_terminal_msg(&m[0], m.size(), rec));
+	CHECK(!strcmp(rec.serial, "1"));
+}
+
+int main()
+{
+	test_unterminated_body();
+	test_short_body();
+	if (s_failed)
+	{
+		printf("test_terminal: %d failed\n", s_failed);
+		return 1;
+	}
+	printf("test_terminal: ok\n");
+	return 0;
+}